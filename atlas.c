@@ -0,0 +1,344 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "atlas.h"
+#include "fonts.h"
+#include "line_break.h"
+#include "layout.h"
+#include "parser.h"
+#include "raster_pool.h"
+#include "render.h"
+#include "texture_cache.h"
+
+#ifdef USE_GLYPH_ATLAS
+
+GlyphAtlas *atlases;
+GlyphAtlas *last_atlas;
+unsigned atlas_frame;
+
+GlyphAtlas *find_atlas(int size, int style) {
+  if (last_atlas && last_atlas->size == size && last_atlas->style == style) {
+    return last_atlas;
+  }
+  for (GlyphAtlas *atlas = atlases; atlas; atlas = atlas->next) {
+    if (atlas->size == size && atlas->style == style) {
+      return last_atlas = atlas;
+    }
+  }
+  GlyphAtlas *atlas = calloc(1, sizeof(GlyphAtlas));
+  if (atlas == NULL) {
+    error("メモリを確保できません\n");
+  }
+  atlas->size = size;
+  atlas->style = style;
+  atlas->next = atlases;
+  atlases = atlas;
+  return last_atlas = atlas;
+}
+
+AtlasPage *add_page(GlyphAtlas *atlas) {
+  atlas->pages =
+      realloc(atlas->pages, (atlas->page_count + 1) * sizeof(AtlasPage));
+  if (atlas->pages == NULL) {
+    error("メモリを確保できません\n");
+  }
+  AtlasPage *page = &atlas->pages[atlas->page_count++];
+  memset(page, 0, sizeof(AtlasPage));
+  reserve_texture_bytes(ATLAS_PAGE_BYTES);
+  texture_cache.bytes += ATLAS_PAGE_BYTES;
+  page->texture =
+      SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                        SDL_TEXTUREACCESS_STATIC, ATLAS_PAGE_SIZE,
+                        ATLAS_PAGE_SIZE);
+  if (page->texture == NULL) {
+    error("SDL_CreateTexture Error: %s\n", SDL_GetError());
+  }
+  SDL_SetTextureBlendMode(page->texture, SDL_BLENDMODE_BLEND);
+  return page;
+}
+
+// Reserves a cell for `glyph` with shelf packing, opening a new page when
+// the current one is full.
+AtlasPage *place_glyph(GlyphAtlas *atlas, Glyph *glyph) {
+  AtlasPage *page = atlas->page_count
+                        ? &atlas->pages[atlas->page_count - 1]
+                        : add_page(atlas);
+  if (page->pen_x + glyph->width > ATLAS_PAGE_SIZE) {
+    page->pen_x = 0;
+    page->pen_y += page->row_height + ATLAS_GLYPH_GAP;
+    page->row_height = 0;
+  }
+  if (page->pen_y + glyph->height > ATLAS_PAGE_SIZE) {
+    page = add_page(atlas);
+  }
+  glyph->page = atlas->page_count - 1;
+  glyph->x = page->pen_x;
+  glyph->y = page->pen_y;
+  page->pen_x += glyph->width + ATLAS_GLYPH_GAP;
+  if (glyph->height > page->row_height) {
+    page->row_height = glyph->height;
+  }
+  return page;
+}
+
+// Stores the result of `job` in `glyph` and takes its surface. Glyphs are
+// rendered in white so that vertex colors can tint them.
+void store_glyph(GlyphAtlas *atlas, Glyph *glyph, RasterJob *job) {
+  glyph->advance = job->advance;
+  glyph->offset_x = job->minx < 0 ? job->minx : 0;
+  glyph->pending = false;
+  SDL_Surface *surface = job->surface;
+  if (surface == NULL) {
+    // 空白など描画するものがない文字は送り幅だけを持つ
+    return;
+  }
+  if (surface->w <= ATLAS_PAGE_SIZE && surface->h <= ATLAS_PAGE_SIZE) {
+    glyph->width = surface->w;
+    glyph->height = surface->h;
+    AtlasPage *page = place_glyph(atlas, glyph);
+    SDL_Rect rect = {glyph->x, glyph->y, glyph->width, glyph->height};
+    SDL_UpdateTexture(page->texture, &rect, surface->pixels, surface->pitch);
+  }
+  SDL_FreeSurface(surface);
+}
+
+// Returns the slot of `codepoint`, adding an empty one when it is missing.
+// `found` tells which of the two happened.
+Glyph *probe_glyph(GlyphAtlas *atlas, Uint32 codepoint, bool *found) {
+  if (atlas->glyph_count * 2 >= atlas->glyph_capacity) {
+    int old_capacity = atlas->glyph_capacity;
+    Glyph *old_glyphs = atlas->glyphs;
+    atlas->glyph_capacity = old_capacity ? old_capacity * 2 : 256;
+    atlas->glyphs = calloc(atlas->glyph_capacity, sizeof(Glyph));
+    if (atlas->glyphs == NULL) {
+      error("メモリを確保できません\n");
+    }
+    for (int i = 0; i < old_capacity; i++) {
+      if (old_glyphs[i].used) {
+        Uint32 j = old_glyphs[i].codepoint * 2654435761u;
+        while (atlas->glyphs[j & (atlas->glyph_capacity - 1)].used) {
+          j++;
+        }
+        atlas->glyphs[j & (atlas->glyph_capacity - 1)] = old_glyphs[i];
+      }
+    }
+    free(old_glyphs);
+  }
+
+  Uint32 mask = atlas->glyph_capacity - 1;
+  Uint32 i = codepoint * 2654435761u;
+  while (atlas->glyphs[i & mask].used) {
+    if (atlas->glyphs[i & mask].codepoint == codepoint) {
+      *found = true;
+      return &atlas->glyphs[i & mask];
+    }
+    i++;
+  }
+  Glyph *glyph = &atlas->glyphs[i & mask];
+  glyph->used = true;
+  glyph->codepoint = codepoint;
+  atlas->glyph_count++;
+  *found = false;
+  return glyph;
+}
+
+// Returns the glyph of `codepoint`, rasterizing it on this thread when it
+// is not in the atlas yet.
+Glyph *find_glyph(GlyphAtlas *atlas, Uint32 codepoint) {
+  bool found;
+  Glyph *glyph = probe_glyph(atlas, codepoint, &found);
+  if (!found || glyph->pending) {
+    RasterJob job = {
+        .size = atlas->size, .style = atlas->style, .codepoint = codepoint};
+    rasterize_job(get_font(atlas->size, atlas->style), &job);
+    store_glyph(atlas, glyph, &job);
+  }
+  return glyph;
+}
+
+// Queues jobs for the glyphs of the `length` bytes of `text` that are
+// missing from the atlas, as far as the text is likely to reach before
+// `clip_right`. Advances of glyphs not rasterized yet are guessed.
+void request_glyphs(int size, int style, char *text, int length, int x,
+                    int clip_right) {
+  GlyphAtlas *atlas = find_atlas(size, style);
+  int guess = size / 2;
+  int pen_x = x;
+  char *p = text;
+  char *end = text + length;
+  while (p < end && pen_x < clip_right) {
+    Uint32 codepoint = decode_utf8(&p);
+    bool found;
+    Glyph *glyph = probe_glyph(atlas, codepoint, &found);
+    if (!found) {
+      glyph->pending = true;
+      RasterJob *job = add_raster_job();
+      job->size = size;
+      job->style = style;
+      job->codepoint = codepoint;
+      job->owner = atlas;
+    }
+    pen_x += glyph->pending ? guess : glyph->advance;
+  }
+}
+
+// Rasterizes the requested glyphs on the worker pool and uploads them.
+void rasterize_requested_glyphs() {
+  run_raster_jobs();
+  for (int i = 0; i < raster_job_count; i++) {
+    RasterJob *job = &raster_jobs[i];
+    bool found;
+    GlyphAtlas *atlas = job->owner;
+    store_glyph(atlas, probe_glyph(atlas, job->codepoint, &found), job);
+  }
+  raster_job_count = 0;
+}
+
+void push_quad(AtlasPage *page, Glyph *glyph, float x, float y,
+               SDL_Color color) {
+  if (page->quad_count == page->quad_capacity) {
+    page->quad_capacity = page->quad_capacity ? page->quad_capacity * 2 : 256;
+    page->vertices = realloc(page->vertices,
+                             page->quad_capacity * 4 * sizeof(SDL_Vertex));
+    page->indices =
+        realloc(page->indices, page->quad_capacity * 6 * sizeof(int));
+    if (page->vertices == NULL || page->indices == NULL) {
+      error("メモリを確保できません\n");
+    }
+  }
+  float u0 = (float)glyph->x / ATLAS_PAGE_SIZE;
+  float v0 = (float)glyph->y / ATLAS_PAGE_SIZE;
+  float u1 = (float)(glyph->x + glyph->width) / ATLAS_PAGE_SIZE;
+  float v1 = (float)(glyph->y + glyph->height) / ATLAS_PAGE_SIZE;
+  float x1 = x + glyph->width;
+  float y1 = y + glyph->height;
+
+  int base = page->quad_count * 4;
+  SDL_Vertex *v = &page->vertices[base];
+  v[0] = (SDL_Vertex){{x, y}, color, {u0, v0}};
+  v[1] = (SDL_Vertex){{x1, y}, color, {u1, v0}};
+  v[2] = (SDL_Vertex){{x1, y1}, color, {u1, v1}};
+  v[3] = (SDL_Vertex){{x, y1}, color, {u0, v1}};
+  int *index = &page->indices[page->quad_count * 6];
+  index[0] = base;
+  index[1] = base + 1;
+  index[2] = base + 2;
+  index[3] = base;
+  index[4] = base + 2;
+  index[5] = base + 3;
+  page->quad_count++;
+}
+
+// Queues the `length` bytes of `text` with its pen starting at (x, y), the
+// top of the line, in render target coordinates. Glyphs left of 0 or right
+// of `clip_right` are not queued. Nothing is drawn until flush_text().
+void queue_text(int size, int style, char *text, int length, int x, int y,
+                SDL_Color color, int clip_right) {
+  GlyphAtlas *atlas = find_atlas(size, style);
+  TTF_Font *font = get_font(size, style);
+  atlas->last_frame = atlas_frame;
+  color.a = 255;
+  int pen_x = x;
+  Uint32 previous = 0;
+  char *p = text;
+  char *end = text + length;
+  while (p < end && pen_x < clip_right) {
+    Uint32 codepoint = decode_utf8(&p);
+    if (previous) {
+      pen_x += TTF_GetFontKerningSizeGlyphs32(font, previous, codepoint);
+    }
+    Glyph *glyph = find_glyph(atlas, codepoint);
+    if (glyph->width > 0 && pen_x + glyph->offset_x + glyph->width > 0) {
+      push_quad(&atlas->pages[glyph->page], glyph,
+                (float)(pen_x + glyph->offset_x), (float)y, color);
+    }
+    pen_x += glyph->advance;
+    previous = codepoint;
+  }
+}
+
+// Draws every queued quad with one SDL_RenderGeometry call per atlas page.
+void flush_text() {
+  for (GlyphAtlas *atlas = atlases; atlas; atlas = atlas->next) {
+    for (int i = 0; i < atlas->page_count; i++) {
+      AtlasPage *page = &atlas->pages[i];
+      if (page->quad_count == 0) {
+        continue;
+      }
+      SDL_RenderGeometry(renderer, page->texture, page->vertices,
+                         page->quad_count * 4, page->indices,
+                         page->quad_count * 6);
+      page->quad_count = 0;
+    }
+  }
+}
+
+void free_atlas(GlyphAtlas *atlas) {
+  if (atlas == last_atlas) {
+    last_atlas = NULL;
+  }
+  for (int i = 0; i < atlas->page_count; i++) {
+    SDL_DestroyTexture(atlas->pages[i].texture);
+    free(atlas->pages[i].vertices);
+    free(atlas->pages[i].indices);
+  }
+  texture_cache.bytes -= atlas->page_count * ATLAS_PAGE_BYTES;
+  free(atlas->pages);
+  free(atlas->glyphs);
+  free(atlas);
+}
+
+// Starts a new frame and drops whole atlases, least recently drawn first,
+// while the textures are over budget. Atlases drawn in the previous frame
+// are kept; they are likely needed again right away.
+void trim_glyph_atlases() {
+  atlas_frame++;
+  while (texture_cache.bytes > texture_cache.budget) {
+    GlyphAtlas **oldest = NULL;
+    for (GlyphAtlas **atlas = &atlases; *atlas; atlas = &(*atlas)->next) {
+      if ((*atlas)->last_frame + 1 < atlas_frame &&
+          (oldest == NULL || (*atlas)->last_frame < (*oldest)->last_frame)) {
+        oldest = atlas;
+      }
+    }
+    if (oldest == NULL) {
+      break;
+    }
+    GlyphAtlas *atlas = *oldest;
+    *oldest = atlas->next;
+    free_atlas(atlas);
+  }
+}
+
+void free_glyph_atlases() {
+  while (atlases) {
+    GlyphAtlas *atlas = atlases;
+    atlases = atlas->next;
+    free_atlas(atlas);
+  }
+}
+
+#else
+
+void queue_text(int size, int style, char *text, int length, int x, int y,
+                SDL_Color color, int clip_right) {}
+
+void flush_text() {}
+
+void request_glyphs(int size, int style, char *text, int length, int x,
+                    int clip_right) {}
+
+void rasterize_requested_glyphs() {}
+
+void trim_glyph_atlases() {}
+
+void free_glyph_atlases() {}
+
+#endif
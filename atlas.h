@@ -0,0 +1,74 @@
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#ifndef BROWSER_ATLAS_H
+#define BROWSER_ATLAS_H
+
+// SDL_RenderGeometry と TTF_RenderGlyph32_Blended は 2.0.18 から。
+// それより古い環境ではテキストを文字列ごとのテクスチャで描画する。
+#if SDL_VERSION_ATLEAST(2, 0, 18) && SDL_TTF_VERSION_ATLEAST(2, 0, 18)
+#define USE_GLYPH_ATLAS
+#endif
+
+#define ATLAS_PAGE_SIZE 1024
+#define ATLAS_PAGE_BYTES ((size_t)ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE * 4)
+#define ATLAS_GLYPH_GAP 1
+
+// Where a rasterized glyph lives in its atlas. The cell is as tall as the
+// font and its left edge sits `offset_x` pixels from the pen position.
+typedef struct {
+  Uint32 codepoint;
+  bool used;
+  bool pending;
+  short page;
+  short x;
+  short y;
+  short width;
+  short height;
+  short offset_x;
+  short advance;
+} Glyph;
+
+// One texture of an atlas together with the quads queued against it for
+// the current frame.
+typedef struct {
+  SDL_Texture *texture;
+  int pen_x;
+  int pen_y;
+  int row_height;
+  SDL_Vertex *vertices;
+  int *indices;
+  int quad_count;
+  int quad_capacity;
+} AtlasPage;
+
+// Glyphs of the page font at one pixel size in one style, filled on demand.
+typedef struct GlyphAtlas {
+  int size;
+  int style;
+  Glyph *glyphs;
+  int glyph_count;
+  int glyph_capacity;
+  AtlasPage *pages;
+  int page_count;
+  unsigned last_frame;
+  struct GlyphAtlas *next;
+} GlyphAtlas;
+
+void queue_text(int size, int style, char *text, int length, int x, int y,
+                SDL_Color color, int clip_right);
+
+void flush_text();
+
+void request_glyphs(int size, int style, char *text, int length, int x,
+                    int clip_right);
+
+void rasterize_requested_glyphs();
+
+void trim_glyph_atlases();
+
+void free_glyph_atlases();
+
+#endif
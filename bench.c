@@ -0,0 +1,438 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "atlas.h"
+#include "fonts.h"
+#include "layout.h"
+#include "parser.h"
+#include "raster_pool.h"
+#include "render.h"
+#include "texture_cache.h"
+#include "word_cache.h"
+
+// Headless micro-benchmarks for the tokenizer, the CSS parser, layout and
+// painting. Painting goes to a software renderer backed by an offscreen
+// surface, so no display is needed. Built with -DCOUNT_ALLOCATIONS and
+// linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc, each stage
+// also reports its heap allocations per run.
+//
+//   bench [-n iterations] [file.html ...]
+
+#define BENCH_PAGE_SIZE (1024 * 1024)
+#define DEFAULT_ITERATIONS 20
+
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+} Buffer;
+
+typedef void (*PageGenerator)(Buffer *buffer);
+
+typedef struct {
+  char *name;
+  PageGenerator generate;
+} Page;
+
+int iterations = DEFAULT_ITERATIONS;
+// 計測中の区間で呼ばれた malloc・calloc・realloc の数
+int sample_allocations;
+int stage_allocations;
+
+void append(Buffer *buffer, char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int length = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  if (buffer->length + length + 1 > buffer->capacity) {
+    buffer->capacity = (buffer->length + length + 1) * 2;
+    buffer->data = realloc(buffer->data, buffer->capacity);
+  }
+  va_start(ap, fmt);
+  vsnprintf(buffer->data + buffer->length, length + 1, fmt, ap);
+  va_end(ap);
+  buffer->length += length;
+}
+
+void generate_deep_nesting(Buffer *buffer) {
+  while (buffer->length < BENCH_PAGE_SIZE) {
+    for (int i = 0; i < 400; i++) {
+      append(buffer, i % 2 ? "<span>" : "<div>");
+    }
+    append(buffer, "nested text");
+    for (int i = 399; i >= 0; i--) {
+      append(buffer, i % 2 ? "</span>" : "</div>");
+    }
+    append(buffer, "\n");
+  }
+}
+
+void generate_inline_spans(Buffer *buffer) {
+  while (buffer->length < BENCH_PAGE_SIZE) {
+    append(buffer, "<p>");
+    for (int i = 0; i < 50; i++) {
+      append(buffer, "<span>word%d</span> <em>emphasis</em> ", i);
+    }
+    append(buffer, "</p>\n");
+  }
+}
+
+void generate_long_paragraphs(Buffer *buffer) {
+  while (buffer->length < BENCH_PAGE_SIZE) {
+    append(buffer, "<p>");
+    for (int i = 0; i < 4000; i++) {
+      append(buffer, "lorem ipsum  dolor\n\tsit amet ");
+    }
+    append(buffer, "</p>\n");
+  }
+}
+
+void generate_inline_styles(Buffer *buffer) {
+  int n = 0;
+  while (buffer->length < BENCH_PAGE_SIZE) {
+    append(buffer, "<div style=\"font-size: %d%%;\">", 100 + n % 4 * 10);
+    for (int i = 0; i < 40; i++, n++) {
+      append(buffer,
+             "<span style=\"color: #%02X%02X00; font-weight: %s; "
+             "text-decoration: %s;\">styled</span>",
+             n * 37 % 256, n * 11 % 256, n % 3 ? "normal" : "bold",
+             n % 5 ? "none" : "underline");
+    }
+    append(buffer, "</div>\n");
+  }
+}
+
+void generate_large_scripts(Buffer *buffer) {
+  while (buffer->length < BENCH_PAGE_SIZE) {
+    append(buffer, "<script>\n");
+    for (int i = 0; i < 4000; i++) {
+      append(buffer, "if (a < b && c > d) { x = \"<p>\" + y[%d]; }\n", i);
+    }
+    append(buffer, "</script>\n<p>after script</p>\n");
+  }
+}
+
+void generate_comments(Buffer *buffer) {
+  while (buffer->length < BENCH_PAGE_SIZE) {
+    append(buffer, "<!--\n");
+    for (int i = 0; i < 200; i++) {
+      append(buffer, "  commented out <div> markup - with -- dashes\n");
+    }
+    append(buffer, "-->\n<p>between comments</p>\n");
+  }
+}
+
+void generate_style_rules(Buffer *buffer) {
+  append(buffer, "<style>\n");
+  for (int i = 0; i < 5000; i++) {
+    append(buffer, ".c%d { color: #%02X0000; }\n#id%d { font-weight: bold; }\n",
+           i, i % 256, i);
+  }
+  append(buffer, "p { font-style: italic; }\n</style>\n");
+  for (int n = 0; buffer->length < BENCH_PAGE_SIZE; n++) {
+    append(buffer, "<p class=\"c%d c%d\" id=\"id%d\">rule %d</p>\n", n % 5000,
+           n * 7 % 5000, n % 9000, n);
+  }
+}
+
+// Declarations the CSS parser does not support must be skipped, not end the
+// program.
+void generate_unsupported_css(Buffer *buffer) {
+  append(buffer, "<style>\n"
+                 "h1 { color: red; }\n"
+                 "body { font-size: 14px; }\n"
+                 ".w { font-weight: 700; color: #00F; }\n"
+                 ".f { display: flex; font-style: oblique; }\n"
+                 "p { text-decoration: line-through; font-size: 90%%; }\n"
+                 "</style>\n<body>\n");
+  for (int n = 0; buffer->length < BENCH_PAGE_SIZE; n++) {
+    append(buffer,
+           "<h1>heading %d</h1><p class=\"w\">weight</p>"
+           "<div class=\"f\" style=\"font-size: 1.5em;\">flex %d</div>\n",
+           n, n);
+  }
+  append(buffer, "</body>\n");
+}
+
+Page pages[] = {
+    {"deep-nesting", generate_deep_nesting},
+    {"inline-spans", generate_inline_spans},
+    {"long-paragraphs", generate_long_paragraphs},
+    {"inline-styles", generate_inline_styles},
+    {"large-scripts", generate_large_scripts},
+    {"comments", generate_comments},
+    {"style-rules", generate_style_rules},
+    {"unsupported-css", generate_unsupported_css},
+};
+
+char *css_samples[] = {
+    "color: #FF0000;",
+    "font-size: 120%;",
+    "font-weight: bold; font-style: italic;",
+    "color: #007F00; text-decoration: underline; display: inline;",
+    "font-weight: normal; font-style: normal; display: block;",
+};
+
+double now_ms() {
+  return (double)SDL_GetPerformanceCounter() * 1000.0 /
+         (double)SDL_GetPerformanceFrequency();
+}
+
+#ifdef COUNT_ALLOCATIONS
+// リンカが malloc などの呼び出しを __wrap_ の関数へ向ける。SDL と SDL_ttf は
+// SDL_malloc を使うので、SDL_SetMemoryFunctions で同じ関数を通す。FreeType
+// が自分で呼ぶ malloc は共有ライブラリの中なので数えられない
+SDL_atomic_t allocation_count;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  SDL_AtomicAdd(&allocation_count, 1);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  SDL_AtomicAdd(&allocation_count, 1);
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+  SDL_AtomicAdd(&allocation_count, 1);
+  return __real_realloc(pointer, size);
+}
+#endif
+
+int allocation_total() {
+#ifdef COUNT_ALLOCATIONS
+  return SDL_AtomicGet(&allocation_count);
+#else
+  return 0;
+#endif
+}
+
+// Starts timing one run of a stage.
+double start_sample() {
+  sample_allocations = allocation_total();
+  return now_ms();
+}
+
+// Returns the time since start_sample() and adds the run's allocations to
+// the stage.
+double end_sample(double start) {
+  double elapsed = now_ms() - start;
+  stage_allocations += allocation_total() - sample_allocations;
+  return elapsed;
+}
+
+int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+double percentile(double *samples, int count, int p) {
+  int rank = (count * p + 99) / 100;
+  return samples[rank > 0 ? rank - 1 : 0];
+}
+
+// Prints latency percentiles of `samples`, the throughput of `units`
+// processed per run at the median latency, and the heap allocations per
+// run when built with COUNT_ALLOCATIONS.
+void report(char *stage, double *samples, int count, double units,
+            char *unit_name, double bytes) {
+  qsort(samples, count, sizeof(double), compare_double);
+  double p50 = percentile(samples, count, 50);
+  printf("  %-10s p50 %9.3f ms  p90 %9.3f ms  p99 %9.3f ms  %10.0f %s/s",
+         stage, p50, percentile(samples, count, 90),
+         percentile(samples, count, 99), units / (p50 / 1000.0), unit_name);
+  if (bytes > 0) {
+    printf("  %8.1f MB/s", bytes / (1024.0 * 1024.0) / (p50 / 1000.0));
+  }
+#ifdef COUNT_ALLOCATIONS
+  printf("  %9.1f allocs/run", (double)stage_allocations / count);
+#endif
+  printf("\n");
+  stage_allocations = 0;
+}
+
+int count_tokens(Token *token) {
+  int count = 0;
+  for (; token->kind != TK_EOF; token = token->next) {
+    count++;
+  }
+  return count;
+}
+
+void bench_document(char *name, char *source, size_t length) {
+  double *samples = calloc(iterations, sizeof(double));
+  Document *document = NULL;
+  for (int i = 0; i < iterations; i++) {
+    if (document) {
+      free_document(document);
+    }
+    char *copy = malloc(length + 1);
+    memcpy(copy, source, length + 1);
+    double start = start_sample();
+    document = parse_document(copy, length);
+    samples[i] = end_sample(start);
+  }
+
+  int tokens = count_tokens(document->token);
+  printf("%s: %.1f KB, %d tokens, %u nodes, %d styles, %zu arena blocks "
+         "(%.1f KB)\n",
+         name, length / 1024.0, tokens, document->node_count,
+         document->styles.count, document->arena.block_count,
+         document->arena.reserved / 1024.0);
+  report("tokenize", samples, iterations, tokens, "tokens", length);
+
+  DisplayList list = {0};
+  for (int i = 0; i < iterations; i++) {
+    double start = start_sample();
+    layout_document(&list, document->token, NULL, window_width);
+    samples[i] = end_sample(start);
+  }
+  report("layout", samples, iterations, tokens, "tokens", 0);
+
+  // ウィンドウの端をドラッグしたときのように、幅を少しずつ変える
+  for (int i = 0; i < iterations; i++) {
+    double start = start_sample();
+    resize_layout(&list, document, window_width - 8 * (i % 8 + 1));
+    samples[i] = end_sample(start);
+  }
+  report("resize", samples, iterations, tokens, "tokens", 0);
+  resize_layout(&list, document, window_width);
+
+  // 最初の描画だけがテキストのラスタライズを含む
+  for (int i = 0; i < iterations; i++) {
+    double start = start_sample();
+    draw_window(&list);
+    samples[i] = end_sample(start);
+  }
+  report("paint", samples, iterations, 1, "frames", 0);
+
+  // グリフもタイルも無い状態からの描画 (初回表示やリサイズ後に相当)
+  for (int i = 0; i < iterations; i++) {
+    free_glyph_atlases();
+    invalidate_tiles();
+    double start = start_sample();
+    draw_window(&list);
+    samples[i] = end_sample(start);
+  }
+  report("cold paint", samples, iterations, 1, "frames", 0);
+
+  // ページ全体に散らばった位置へスクロールして描画する
+  invalidate_tiles();
+  for (int i = 0; i < iterations; i++) {
+    scroll_offset_y = (int)((long long)list.height * i / iterations);
+    double start = start_sample();
+    draw_window(&list);
+    samples[i] = end_sample(start);
+  }
+  scroll_offset_y = 0;
+  report("scroll", samples, iterations, 1, "frames", 0);
+
+  // ホイールで下へ送り続け、フレームの間に先読みさせる
+  invalidate_tiles();
+  for (int i = 0; i < iterations; i++) {
+    while (prefetch_tile(&list)) {
+      continue;
+    }
+    scroll_offset_y += 3 * 20;
+    if (scroll_offset_y > list.height - window_height) {
+      scroll_offset_y = 0;
+    }
+    track_scroll(0, 3 * 20);
+    double start = start_sample();
+    draw_window(&list);
+    samples[i] = end_sample(start);
+  }
+  scroll_offset_y = 0;
+  report("prefetched", samples, iterations, 1, "frames", 0);
+
+  free_display_list(&list);
+  free_document(document);
+  free(samples);
+}
+
+void bench_css() {
+  int count = sizeof(css_samples) / sizeof(css_samples[0]);
+  int repeat = 20000;
+  double *samples = calloc(iterations, sizeof(double));
+  for (int i = 0; i < iterations; i++) {
+    double start = start_sample();
+    for (int j = 0; j < repeat; j++) {
+      CssProperty css_property = {{0, 0, 0}, 100};
+      parse_css(css_samples[j % count], &css_property);
+    }
+    samples[i] = end_sample(start);
+  }
+  printf("css: %d declaration blocks per run\n", repeat);
+  report("parse_css", samples, iterations, repeat, "blocks", 0);
+  free(samples);
+}
+
+int main(int argc, char *argv[]) {
+  int first_file = 1;
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    iterations = atoi(argv[2]);
+    first_file = 3;
+  }
+  if (iterations <= 0) {
+    error("繰り返し回数が正しくありません\n");
+  }
+
+#ifdef COUNT_ALLOCATIONS
+  SDL_SetMemoryFunctions(__wrap_malloc, __wrap_calloc, __wrap_realloc, free);
+#endif
+  if (TTF_Init() == -1) {
+    error("TTF_Init Error: %s\n", TTF_GetError());
+  }
+  SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(
+      0, window_width, window_height, 32, SDL_PIXELFORMAT_ARGB8888);
+  renderer = SDL_CreateSoftwareRenderer(surface);
+  if (!renderer) {
+    error("SDL_CreateSoftwareRenderer Error: %s\n", SDL_GetError());
+  }
+  open_fonts("./RictyDiminished.ttf");
+  start_raster_pool();
+
+  printf("%d iterations per stage\n\n", iterations);
+  bench_css();
+  printf("\n");
+
+  for (int i = 0; i < (int)(sizeof(pages) / sizeof(pages[0])); i++) {
+    Buffer buffer = {0};
+    pages[i].generate(&buffer);
+    bench_document(pages[i].name, buffer.data, buffer.length);
+    free(buffer.data);
+  }
+
+  for (int i = first_file; i < argc; i++) {
+    size_t length;
+    char *source = read_file(argv[i], &length);
+    bench_document(argv[i], source, length);
+    free(source);
+  }
+
+  free_tiles();
+  free_glyph_atlases();
+  stop_raster_pool();
+  free_texture_cache();
+  free_word_cache();
+  close_fonts();
+  SDL_DestroyRenderer(renderer);
+  SDL_FreeSurface(surface);
+  TTF_Quit();
+  SDL_Quit();
+  return 0;
+}
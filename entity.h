@@ -0,0 +1,25 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef BROWSER_ENTITY_H
+#define BROWSER_ENTITY_H
+
+// 名前付き文字参照の完全ハッシュ。1段目でバケツを選び、バケツごとの種で
+// 2段目の位置を決める
+#define ENTITY_BUCKETS 1024
+#define ENTITY_SLOTS 4096
+
+// A named character reference. Names keep their `;`; the legacy names that
+// may appear without it are listed a second time without it.
+typedef struct {
+  const char *name;
+  const char *value;
+} Entity;
+
+void init_entities();
+
+int decode_reference(char **p, char *end, char *out);
+
+int decode_references(char *out, char *p, char *end);
+
+#endif
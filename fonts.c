@@ -0,0 +1,147 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "fonts.h"
+#include "parser.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define USE_MMAP
+#endif
+
+// The font file is loaded once; every face is opened from this image.
+void *font_image;
+size_t font_image_size;
+bool font_image_mapped;
+
+// Faces of the main thread, used by layout and painting.
+FontCache main_fonts;
+
+TTF_Font *open_face(int size, int style) {
+  SDL_RWops *rw = SDL_RWFromConstMem(font_image, (int)font_image_size);
+  TTF_Font *font = rw != NULL ? TTF_OpenFontRW(rw, 1, size) : NULL;
+  if (font == NULL) {
+    error("TTF_OpenFont Error: %s\n", TTF_GetError());
+  }
+  TTF_SetFontStyle(font, style);
+  return font;
+}
+
+// Loads the font file used for all text. Faces are opened lazily.
+void open_fonts(char *font_path) {
+#ifdef USE_MMAP
+  int fd = open(font_path, O_RDONLY);
+  struct stat st;
+  if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image != MAP_FAILED) {
+      font_image = image;
+      font_image_size = st.st_size;
+      font_image_mapped = true;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+#endif
+  if (font_image == NULL) {
+    font_image = read_file(font_path, &font_image_size);
+  }
+  // 壊れたフォントは起動時に気付けるよう、一度開いておく
+  get_font(16, TTF_STYLE_NORMAL);
+}
+
+void close_fonts() {
+  free_font_cache(&main_fonts);
+#ifdef USE_MMAP
+  if (font_image_mapped) {
+    munmap(font_image, font_image_size);
+    font_image = NULL;
+  }
+#endif
+  free(font_image);
+  font_image = NULL;
+  font_image_size = 0;
+  font_image_mapped = false;
+}
+
+// Returns the face of `size` pixels in `style` from `cache`, opening it when
+// missing. Faces may only be opened or closed on the main thread.
+TTF_Font *cached_font(FontCache *cache, int size, int style) {
+  for (int i = 0; i < cache->count; i++) {
+    FontFace *face = &cache->faces[i];
+    if (face->size == size && face->style == style) {
+      face->last_used = cache->clock;
+      return face->font;
+    }
+  }
+  FontFace *face = NULL;
+  if (cache->count >= FONT_CACHE_SIZE) {
+    // 今使っているものは残す
+    for (int i = 0; i < cache->count; i++) {
+      FontFace *candidate = &cache->faces[i];
+      if (candidate->last_used != cache->clock &&
+          (face == NULL || candidate->last_used < face->last_used)) {
+        face = candidate;
+      }
+    }
+  }
+  if (face != NULL) {
+    TTF_CloseFont(face->font);
+  } else {
+    if (cache->count == cache->capacity) {
+      cache->capacity = cache->capacity ? cache->capacity * 2 : 8;
+      cache->faces =
+          realloc(cache->faces, cache->capacity * sizeof(FontFace));
+      if (cache->faces == NULL) {
+        error("メモリを確保できません\n");
+      }
+    }
+    face = &cache->faces[cache->count++];
+  }
+  face->size = size;
+  face->style = style;
+  face->last_used = cache->clock;
+  face->font = open_face(size, style);
+  return face->font;
+}
+
+// Returns a face of the main thread. The pointer stays valid until the
+// next tick_font_cache(&main_fonts).
+TTF_Font *get_font(int size, int style) {
+  return cached_font(&main_fonts, size, style);
+}
+
+// Starts a new period of use and closes the least recently used faces
+// beyond FONT_CACHE_SIZE.
+void tick_font_cache(FontCache *cache) {
+  cache->clock++;
+  while (cache->count > FONT_CACHE_SIZE) {
+    int oldest = 0;
+    for (int i = 1; i < cache->count; i++) {
+      if (cache->faces[i].last_used < cache->faces[oldest].last_used) {
+        oldest = i;
+      }
+    }
+    TTF_CloseFont(cache->faces[oldest].font);
+    cache->faces[oldest] = cache->faces[--cache->count];
+  }
+}
+
+void free_font_cache(FontCache *cache) {
+  for (int i = 0; i < cache->count; i++) {
+    TTF_CloseFont(cache->faces[i].font);
+  }
+  free(cache->faces);
+  *cache = (FontCache){0};
+}
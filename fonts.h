@@ -0,0 +1,45 @@
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#ifndef BROWSER_FONTS_H
+#define BROWSER_FONTS_H
+
+#define FONT_CACHE_SIZE 16
+
+// A face of the page font opened at one pixel size. Its style is set once
+// when it is opened, because changing the style of a face flushes its
+// glyph cache.
+typedef struct {
+  int size;
+  int style;
+  unsigned last_used;
+  TTF_Font *font;
+} FontFace;
+
+// Faces used by one thread, evicted least recently used first. Faces used
+// since the last tick_font_cache() are never evicted, so a cache can hold
+// more than FONT_CACHE_SIZE faces until the next tick.
+typedef struct {
+  FontFace *faces;
+  int count;
+  int capacity;
+  unsigned clock;
+} FontCache;
+
+extern FontCache main_fonts;
+
+void open_fonts(char *font_path);
+
+void close_fonts();
+
+TTF_Font *cached_font(FontCache *cache, int size, int style);
+
+TTF_Font *get_font(int size, int style);
+
+void tick_font_cache(FontCache *cache);
+
+void free_font_cache(FontCache *cache);
+
+#endif
@@ -0,0 +1,713 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "fonts.h"
+#include "layout.h"
+#include "parser.h"
+#include "word_cache.h"
+
+// 見出しと本文の文字の大きさ (ピクセル)。font-size の % はこれに掛ける
+const int font_size_p = 16;
+const int font_size_h1 = 48;
+const int font_size_h2 = 32;
+const int font_size_h3 = 20;
+
+const int win_padding_x = 20;
+const int win_padding_y = 20;
+const int line_space = 10;
+
+// レイアウトのたびに増え、描画済みタイルが古いかどうかの判定に使う
+unsigned layout_generation = 0;
+
+DisplayItem *push_item(DisplayList *list, DisplayItemKind kind) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 256;
+    list->items = realloc(list->items, list->capacity * sizeof(DisplayItem));
+    if (list->items == NULL) {
+      error("メモリを確保できません\n");
+    }
+  }
+  DisplayItem *item = &list->items[list->count++];
+  memset(item, 0, sizeof(DisplayItem));
+  item->kind = kind;
+  return item;
+}
+
+LineBox *push_line(DisplayList *list) {
+  if (list->line_count == list->line_capacity) {
+    list->line_capacity = list->line_capacity ? list->line_capacity * 2 : 64;
+    list->lines = realloc(list->lines, list->line_capacity * sizeof(LineBox));
+    if (list->lines == NULL) {
+      error("メモリを確保できません\n");
+    }
+  }
+  return &list->lines[list->line_count++];
+}
+
+// Groups the items into line boxes. A text run or marker at a new y starts
+// a line; decorations stay with the run they were emitted after. Lines
+// already indexed are kept; only the last one can still take new items.
+void index_lines(DisplayList *list) {
+  LineBox *line = NULL;
+  int reach = 0;
+  int first = 0;
+  if (list->line_count > 0) {
+    line = &list->lines[list->line_count - 1];
+    reach = line->reach;
+    first = line->first + line->count;
+  }
+  for (int i = first; i < list->count; i++) {
+    DisplayItem *item = &list->items[i];
+    if (line == NULL ||
+        (item->kind != ITEM_DECORATION && item->y != line->top)) {
+      line = push_line(list);
+      line->top = item->y;
+      line->bottom = item->y;
+      line->first = i;
+      line->count = 0;
+    }
+    line->count++;
+    if (item->y < line->top) {
+      line->top = item->y;
+    }
+    if (item->y + item->height > line->bottom) {
+      line->bottom = item->y + item->height;
+    }
+    if (line->bottom > reach) {
+      reach = line->bottom;
+    }
+    line->reach = reach;
+  }
+}
+
+// Returns the index of the first line whose items may reach below `top`,
+// or line_count if none does.
+int find_first_line(DisplayList *list, int top) {
+  int low = 0;
+  int high = list->line_count;
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    if (list->lines[mid].reach <= top) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+int font_style_of(CssProperty *css_property) {
+  int font_style = TTF_STYLE_NORMAL;
+  if (css_property->font_weight == FONT_BOLD) {
+    font_style |= TTF_STYLE_BOLD;
+  }
+  if (css_property->font_style == FONT_ITALIC) {
+    font_style |= TTF_STYLE_ITALIC;
+  }
+  return font_style;
+}
+
+// Pushes the `length` bytes at `offset` in the text of `token` as one line
+// of text, underlined if the style asks for it.
+void push_text(DisplayList *list, LayoutState *state, Token *token, int x,
+               int offset, int length, int width, int font_size) {
+  CssProperty *css_property = token->css_property;
+  DisplayItem *item = push_item(list, ITEM_TEXT);
+  item->x = win_padding_x + x;
+  item->y = win_padding_y + state->cor_y;
+  item->text = token->text + offset;
+  item->offset = offset;
+  item->length = length;
+  item->width = width;
+  item->font_size = font_size;
+  item->font_style = font_style_of(css_property);
+  item->color = css_property->color;
+  item->token_index = token->index;
+  TTF_Font *font = get_font(font_size, item->font_style);
+  item->height = TTF_FontHeight(font);
+
+  if (css_property->text_decoration == TEXT_UNDERLINE) {
+    int thickness = item->height / 20 + 1;
+    DisplayItem *decoration = push_item(list, ITEM_DECORATION);
+    decoration->x = item->x;
+    decoration->y = item->y + TTF_FontAscent(font) + thickness;
+    decoration->width = width;
+    decoration->height = thickness;
+    decoration->color = css_property->color;
+    decoration->token_index = token->index;
+  }
+  if (x + width > state->max_width) {
+    state->max_width = x + width;
+  }
+}
+
+// Lays out the text of `token` from the current position. Lines break at
+// the last break opportunity the tokenizer found before the right edge of
+// the page, and wrapped lines start at `wrap_x`. Widths come from the word
+// cache, so laying out the same text at another width does not touch the
+// font.
+void layout_text(DisplayList *list, LayoutState *state, Token *token,
+                 int font_size, int wrap_x, bool continued) {
+  int font_style = font_style_of(token->css_property);
+  int height = TTF_FontHeight(get_font(font_size, font_style)) + line_space;
+  int right = list->layout_width - win_padding_x * 2;
+  int space = measure_word(font_size, font_style, " ", 1);
+  // 前の run と同じ行に続くときは、その行の高さも引き継ぐ
+  int line_height = continued ? state->last_height : 0;
+
+  char *text = token->text;
+  char *end = text + token->length;
+  char *line = text;
+  char *line_end = text;
+  int line_x = state->cor_x;
+  int width = 0;
+  char *p = text;
+  int next_break = 0;
+  while (p < end) {
+    // 次の改行位置までを1つの単語として測る。前後の空白は幅だけ数える
+    char *segment_end = next_break < token->break_count
+                            ? text + token->breaks[next_break++]
+                            : end;
+    char *word = p;
+    while (word < segment_end && *word == ' ') {
+      word++;
+    }
+    char *word_end = segment_end;
+    while (word_end > word && word_end[-1] == ' ') {
+      word_end--;
+    }
+    int word_width =
+        word_end > word ? measure_word(font_size, font_style, word,
+                                       (int)(word_end - word))
+                        : 0;
+    int spaces_width = (int)(word - p) * space;
+    bool empty = line_end == line && line_x <= wrap_x;
+    int reach = line_x + width + spaces_width + word_width;
+    if (word < end && !empty && reach > state->reach) {
+      // 行頭の単語はどの幅でも折り返さないので数えない
+      state->reach = reach;
+    }
+    if (word < end && reach > right && !empty) {
+      state->reach = BLOCK_WRAPPED;
+      // 単語の前で折り返す
+      if (line_end > line) {
+        push_text(list, state, token, line_x, (int)(line - text),
+                  (int)(line_end - line), width, font_size);
+        line_height = line_height > height ? line_height : height;
+      }
+      state->cor_y += line_height;
+      line_height = 0;
+      line = word;
+      line_x = wrap_x;
+      width = word_width;
+    } else {
+      width += spaces_width + word_width;
+    }
+    line_end = word_end;
+    p = word_end;
+  }
+  // 最後の行は末尾の空白も含めて次の run の位置を決める
+  push_text(list, state, token, line_x, (int)(line - text),
+            (int)(end - line), width, font_size);
+  state->cor_x = line_x;
+  state->last_width = width;
+  state->last_height = line_height > height ? line_height : height;
+}
+
+void init_layout_state(LayoutState *state) {
+  memset(state, 0, sizeof(LayoutState));
+  state->new_line = true;
+  state->font_size = font_size_p;
+}
+
+// Lays out `token` and advances `state` past it. Tokens inside a
+// display:none element only update the nesting depth.
+void layout_token(DisplayList *list, LayoutState *state, Token *token) {
+  if (state->hidden > 0) {
+    if (token->kind == START_TAG) {
+      state->hidden++;
+    } else if (token->kind == END_TAG) {
+      state->hidden--;
+    }
+    return;
+  }
+  if (token->kind == START_TAG &&
+      token->css_property->display == DISPLAY_NONE) {
+    state->hidden = 1;
+    return;
+  }
+  int index = token->index;
+  state->new_line =
+      ((token->css_property->display == DISPLAY_BLOCK) || state->new_line);
+  switch (token->kind) {
+  case START_TAG:
+    switch (token->tag) {
+    case TAG_H1:
+      state->last_height += 20;
+      state->font_size = font_size_h1;
+      break;
+    case TAG_H2:
+      state->last_height += 15;
+      state->font_size = font_size_h2;
+      break;
+    case TAG_H3:
+      state->last_height += 10;
+      state->font_size = font_size_h3;
+      break;
+    case TAG_P:
+      state->font_size = font_size_p;
+      break;
+    case TAG_LI:
+      state->prefix = "  * ";
+      state->indent = "    ";
+      break;
+    default:
+      break;
+    }
+    break;
+  case START_TAG_ONLY:
+    switch (token->tag) {
+    case TAG_BR:
+      state->cor_x = 0;
+      state->cor_y += state->last_height + line_space;
+      state->new_line = true;
+      break;
+    default:
+      break;
+    }
+    break;
+  case END_TAG:
+    state->new_line = (token->css_property->display == DISPLAY_BLOCK);
+    if ((token->tag == TAG_H1) || (token->tag == TAG_H2) ||
+        (token->tag == TAG_H3) || (token->tag == TAG_P)) {
+      state->font_size = font_size_p;
+    } else if (token->tag == TAG_LI) {
+      state->prefix = NULL;
+      state->indent = NULL;
+    }
+    break;
+  case PLAIN_TEXT: {
+    bool continued = !state->new_line;
+    if (state->new_line) {
+      state->cor_x = 0;
+      state->cor_y += state->last_height;
+      state->new_line = false;
+    } else {
+      state->cor_x += state->last_width;
+    }
+    int font_size = state->font_size * token->css_property->font_size / 100;
+    if (font_size < 1) {
+      font_size = 1;
+    }
+    int wrap_x = 0;
+    if (state->indent != NULL) {
+      wrap_x = measure_word(font_size, TTF_STYLE_NORMAL, state->indent,
+                            strlen(state->indent));
+    }
+    if (state->prefix != NULL) {
+      DisplayItem *item = push_item(list, ITEM_MARKER);
+      item->x = win_padding_x + state->cor_x;
+      item->y = win_padding_y + state->cor_y;
+      item->text = state->prefix;
+      item->length = strlen(state->prefix);
+      item->font_size = font_size;
+      item->font_style = TTF_STYLE_BOLD;
+      item->width = measure_word(font_size, TTF_STYLE_BOLD, item->text,
+                                 item->length);
+      item->height = TTF_FontHeight(get_font(font_size, TTF_STYLE_BOLD));
+      item->color = (SDL_Color){0, 0, 0, 255};
+      item->token_index = index;
+      state->cor_x += item->width;
+      state->prefix = NULL;
+    } else if (state->indent != NULL) {
+      state->cor_x += wrap_x;
+    }
+    layout_text(list, state, token, font_size, wrap_x, continued);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// Block start tags outside hidden content are where layout can be resumed
+// or joined again.
+bool is_checkpoint(LayoutState *state, Token *token) {
+  return state->hidden == 0 && token->kind == START_TAG &&
+         token->css_property->display == DISPLAY_BLOCK;
+}
+
+// After the start tag of a display:none element, jumps to its end tag
+// when the link is known. `complete` tells whether the tokenizer is done
+// writing the links.
+Token *skip_hidden(LayoutState *state, Token *token, bool complete) {
+  if (complete && state->hidden == 1 && token->kind == START_TAG &&
+      token->end != NULL) {
+    state->hidden = 0;
+    return token->end;
+  }
+  return token;
+}
+
+// Ends the block of the last checkpoint with the reach it needed, unless
+// it was already ended.
+void close_block(DisplayList *list, LayoutState *state) {
+  if (list->checkpoint_count > 0 &&
+      list->checkpoints[list->checkpoint_count - 1].reach == BLOCK_OPEN) {
+    list->checkpoints[list->checkpoint_count - 1].reach = state->reach;
+  }
+  state->reach = 0;
+}
+
+void push_checkpoint(DisplayList *list, int index, LayoutState *state) {
+  if (list->checkpoint_count == list->checkpoint_capacity) {
+    list->checkpoint_capacity =
+        list->checkpoint_capacity ? list->checkpoint_capacity * 2 : 64;
+    list->checkpoints = realloc(
+        list->checkpoints, list->checkpoint_capacity * sizeof(Checkpoint));
+    if (list->checkpoints == NULL) {
+      error("メモリを確保できません\n");
+    }
+  }
+  Checkpoint *checkpoint = &list->checkpoints[list->checkpoint_count++];
+  checkpoint->token_index = index;
+  checkpoint->item_count = list->count;
+  checkpoint->reach = BLOCK_OPEN;
+  checkpoint->state = *state;
+}
+
+void finish_layout(DisplayList *list, LayoutState *state) {
+  int reach = state->reach;
+  close_block(list, state);
+  state->reach = reach;
+  list->end_state = *state;
+  index_lines(list);
+  list->width = state->max_width + win_padding_x * 2;
+  list->height = state->cor_y + state->last_height + win_padding_y * 2;
+}
+
+// Widens [*top, *bottom) to cover items [first, last) of `list`.
+void cover_items(DisplayList *list, int first, int last, int *top,
+                 int *bottom) {
+  for (int i = first; i < last; i++) {
+    DisplayItem *item = &list->items[i];
+    if (item->y < *top) {
+      *top = item->y;
+    }
+    if (item->y + item->height > *bottom) {
+      *bottom = item->y + item->height;
+    }
+  }
+}
+
+// Lays out the tokens from `token` through `last` at the end of `list`,
+// continuing from `state`. A NULL `last` lays out up to TK_EOF.
+void layout_tokens(DisplayList *list, LayoutState *state, Token *token,
+                   Token *last) {
+  // 読み込み中は終了タグへのリンクがまだ書き換わるので使わない
+  bool complete = last == NULL || last->kind == TK_EOF;
+  while (token != NULL && token->kind != TK_EOF) {
+    if (is_checkpoint(state, token)) {
+      close_block(list, state);
+      push_checkpoint(list, token->index, state);
+    }
+    layout_token(list, state, token);
+    token = skip_hidden(state, token, complete);
+    list->token_count = token->index + 1;
+    // 公開済みの最後のトークンより先は読まない
+    token = token == last ? NULL : token->next;
+  }
+}
+
+// Lays out the tokens from `token` through `last` into `list`, replacing
+// its previous contents. A NULL `last` lays out up to TK_EOF. `width` is
+// the width available to the page; text wraps to fit inside it.
+void layout_document(DisplayList *list, Token *token, Token *last,
+                     int width) {
+  LayoutState state;
+  init_layout_state(&state);
+  clear_display_list(list);
+  list->layout_width = width;
+  list->generation = ++layout_generation;
+  layout_tokens(list, &state, token, last);
+  finish_layout(list, &state);
+}
+
+// Appends the layout of the tokens after `token` through `last` to `list`,
+// which holds the layout of the document up to `token`. Nothing laid out
+// before moves, so `generation` is kept; page rows from *changed_top down
+// need to be repainted.
+void extend_layout(DisplayList *list, Token *token, Token *last,
+                   int *changed_top) {
+  LayoutState state = list->end_state;
+  // 最後のブロックはまだ続くかもしれないので開き直す
+  if (list->checkpoint_count > 0) {
+    list->checkpoints[list->checkpoint_count - 1].reach = BLOCK_OPEN;
+  }
+  int first_item = list->count;
+  int top = list->height;
+  int bottom = list->height;
+  layout_tokens(list, &state, token == last ? NULL : token->next, last);
+  // 最後の行に続けて置かれたテキストは、前の高さより上から始まる
+  cover_items(list, first_item, list->count, &top, &bottom);
+  *changed_top = top;
+  finish_layout(list, &state);
+}
+
+// Whether laying out the same tokens from `a` and from `b` gives the same
+// items apart from a vertical offset.
+bool same_layout_state(LayoutState *a, LayoutState *b) {
+  return a->cor_x == b->cor_x && a->last_width == b->last_width &&
+         a->last_height == b->last_height && a->new_line == b->new_line &&
+         a->hidden == b->hidden && a->prefix == b->prefix &&
+         a->indent == b->indent && a->font_size == b->font_size;
+}
+
+// Points the text of every item at the tokens of the document starting
+// with `token`.
+void repoint_items(DisplayList *list, Token *token) {
+  Token *cur = token;
+  int index = 0;
+  for (int i = 0; i < list->count; i++) {
+    DisplayItem *item = &list->items[i];
+    for (; index < item->token_index; index++) {
+      cur = cur->next;
+    }
+    if (item->kind == ITEM_TEXT) {
+      item->text = cur->text + item->offset;
+    }
+  }
+}
+
+// Lays out a new version of the document in `list`, starting at `token`,
+// by reusing the layout of the previous version. Layout restarts at the
+// last block before the first changed token and stops at the first block
+// of the unchanged tail reached in the same state as before; the old items
+// from there on are only moved by the change in height. Page rows in
+// [*changed_top, *changed_bottom) need to be repainted.
+void update_layout(DisplayList *list, Token *token, TokenDiff *diff,
+                   int *changed_top, int *changed_bottom) {
+  DisplayList old = *list;
+  DisplayList next = {0};
+  next.layout_width = old.layout_width;
+  next.generation = old.generation;
+
+  // 変更より前にある最後のブロックから再開する
+  int restart = 0;
+  while (restart < old.checkpoint_count &&
+         old.checkpoints[restart].token_index <= diff->prefix) {
+    restart++;
+  }
+  LayoutState state;
+  int index = 0;
+  int first_item = 0;
+  init_layout_state(&state);
+  if (restart > 0) {
+    Checkpoint *checkpoint = &old.checkpoints[restart - 1];
+    state = checkpoint->state;
+    index = checkpoint->token_index;
+    first_item = checkpoint->item_count;
+    for (int i = 0; i < first_item; i++) {
+      *push_item(&next, old.items[i].kind) = old.items[i];
+    }
+    for (int i = 0; i < restart - 1; i++) {
+      push_checkpoint(&next, 0, &state);
+      next.checkpoints[i] = old.checkpoints[i];
+    }
+    // 再開位置のトークンが変わっていれば、前のブロックはそこで終わらない
+    if (restart > 1) {
+      state.reach = old.checkpoints[restart - 2].reach;
+      next.checkpoints[restart - 2].reach = BLOCK_OPEN;
+    }
+  }
+  int restart_y = win_padding_y + state.cor_y;
+
+  Token *cur = token;
+  for (int i = 0; i < index; i++) {
+    cur = cur->next;
+  }
+
+  // 変更のない末尾のブロックに同じ状態で戻ったら、残りは古い結果をずらして使う
+  int shift = diff->new_count - diff->old_count;
+  int tail = diff->old_count - diff->suffix;
+  int join = restart;
+  bool joined = false;
+  while (cur != NULL && cur->kind != TK_EOF) {
+    index = cur->index;
+    while (join < old.checkpoint_count &&
+           (old.checkpoints[join].token_index < tail ||
+            old.checkpoints[join].token_index + shift < index)) {
+      join++;
+    }
+    if (join < old.checkpoint_count &&
+        old.checkpoints[join].token_index + shift == index &&
+        same_layout_state(&state, &old.checkpoints[join].state)) {
+      joined = true;
+      break;
+    }
+    if (is_checkpoint(&state, cur)) {
+      close_block(&next, &state);
+      push_checkpoint(&next, index, &state);
+    }
+    layout_token(&next, &state, cur);
+    cur = skip_hidden(&state, cur, true)->next;
+  }
+
+  int top = INT_MAX;
+  int bottom = INT_MIN;
+  cover_items(&next, first_item, next.count, &top, &bottom);
+  int dy = 0;
+  if (joined) {
+    close_block(&next, &state);
+    Checkpoint *from = &old.checkpoints[join];
+    cover_items(&old, first_item, from->item_count, &top, &bottom);
+    dy = state.cor_y - from->state.cor_y;
+    int max_width = state.max_width;
+    int item_shift = next.count - from->item_count;
+    int c = join;
+    for (int i = from->item_count; i <= old.count; i++) {
+      // 合流後のチェックポイントには、その位置までの最大幅を付け直す
+      while (c < old.checkpoint_count && old.checkpoints[c].item_count == i) {
+        LayoutState moved = old.checkpoints[c].state;
+        moved.cor_y += dy;
+        moved.max_width = max_width;
+        push_checkpoint(&next, old.checkpoints[c].token_index + shift,
+                        &moved);
+        next.checkpoints[next.checkpoint_count - 1].item_count =
+            i + item_shift;
+        next.checkpoints[next.checkpoint_count - 1].reach =
+            old.checkpoints[c].reach;
+        c++;
+      }
+      if (i == old.count) {
+        break;
+      }
+      DisplayItem *item = push_item(&next, old.items[i].kind);
+      *item = old.items[i];
+      item->y += dy;
+      item->token_index += shift;
+      if (item->x - win_padding_x + item->width > max_width) {
+        max_width = item->x - win_padding_x + item->width;
+      }
+    }
+    state = old.end_state;
+    state.cor_y += dy;
+    state.max_width = max_width;
+  } else {
+    cover_items(&old, first_item, old.count, &top, &bottom);
+  }
+  // 高さが変わったときは、以降がすべてずれる
+  bool settled = joined ? dy == 0
+                        : same_layout_state(&state, &old.end_state) &&
+                              state.cor_y == old.end_state.cor_y;
+  if (!settled) {
+    top = top < restart_y ? top : restart_y;
+    bottom = INT_MAX;
+  }
+  *changed_top = top;
+  *changed_bottom = bottom;
+
+  next.token_count = diff->new_count;
+  finish_layout(&next, &state);
+  repoint_items(&next, token);
+  free(old.items);
+  free(old.lines);
+  free(old.checkpoints);
+  *list = next;
+}
+
+// Lays out the complete `document` again at `width`. A block that broke
+// no line and still fits keeps its items, which are only moved by the
+// change in height of the blocks above it; the other blocks are laid out
+// again. The tokens of a kept block are skipped through the node tree.
+void resize_layout(DisplayList *list, Document *document, int width) {
+  DisplayList old = *list;
+  DisplayList next = {0};
+  next.layout_width = width;
+  next.generation = ++layout_generation;
+  int right = width - win_padding_x * 2;
+
+  LayoutState state;
+  init_layout_state(&state);
+  Token *cur = document->token;
+  int k = 0;
+  while (cur != NULL && cur->kind != TK_EOF) {
+    if (!is_checkpoint(&state, cur)) {
+      layout_token(&next, &state, cur);
+      cur = skip_hidden(&state, cur, true)->next;
+      continue;
+    }
+    close_block(&next, &state);
+    push_checkpoint(&next, cur->index, &state);
+    while (k < old.checkpoint_count &&
+           old.checkpoints[k].token_index < (int)cur->index) {
+      k++;
+    }
+    Checkpoint *from = &old.checkpoints[k];
+    if (k == old.checkpoint_count || from->token_index != (int)cur->index ||
+        from->reach > right || !same_layout_state(&state, &from->state)) {
+      layout_token(&next, &state, cur);
+      cur = skip_hidden(&state, cur, true)->next;
+      continue;
+    }
+
+    // 折り返しの無いブロックは、縦にずらすだけで使い回せる
+    bool last = k + 1 == old.checkpoint_count;
+    int item_end = last ? old.count : old.checkpoints[k + 1].item_count;
+    int dy = state.cor_y - from->state.cor_y;
+    int max_width = state.max_width;
+    for (int i = from->item_count; i < item_end; i++) {
+      DisplayItem *item = push_item(&next, old.items[i].kind);
+      *item = old.items[i];
+      item->y += dy;
+      if (item->x - win_padding_x + item->width > max_width) {
+        max_width = item->x - win_padding_x + item->width;
+      }
+    }
+    state = last ? old.end_state : old.checkpoints[k + 1].state;
+    state.cor_y += dy;
+    state.max_width = max_width;
+    state.reach = from->reach;
+    next.checkpoints[next.checkpoint_count - 1].reach = from->reach;
+    if (last) {
+      break;
+    }
+    // 次のブロックの開始タグまで、中の要素は兄弟をたどって飛ばす
+    uint32_t node =
+        find_node(document, cur->node, old.checkpoints[k + 1].token_index);
+    cur = node == NO_NODE ? NULL : node_at(document, node)->token;
+    k++;
+  }
+
+  next.token_count = old.token_count;
+  finish_layout(&next, &state);
+  free(old.items);
+  free(old.lines);
+  free(old.checkpoints);
+  *list = next;
+}
+
+void clear_display_list(DisplayList *list) {
+  list->count = 0;
+  list->line_count = 0;
+  list->width = 0;
+  list->height = 0;
+  list->checkpoint_count = 0;
+  list->token_count = 0;
+}
+
+void free_display_list(DisplayList *list) {
+  clear_display_list(list);
+  free(list->items);
+  free(list->lines);
+  free(list->checkpoints);
+  *list = (DisplayList){0};
+}
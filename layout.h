@@ -0,0 +1,113 @@
+#include <limits.h>
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "parser.h"
+
+#ifndef BROWSER_LAYOUT_H
+#define BROWSER_LAYOUT_H
+
+#define BLOCK_WRAPPED INT_MAX
+#define BLOCK_OPEN -1
+
+typedef enum { ITEM_TEXT, ITEM_MARKER, ITEM_DECORATION } DisplayItemKind;
+
+// A positioned piece of the page. Text is `length` bytes pointing into the
+// document, `offset` bytes into the text of its token, and is rasterized at
+// paint time. A text run broken over several lines gives one item per line.
+typedef struct {
+  DisplayItemKind kind;
+  int x;
+  int y;
+  int width;
+  int height;
+  char *text;
+  int offset;
+  int length;
+  int font_size;
+  int font_style;
+  SDL_Color color;
+  int token_index;
+} DisplayItem;
+
+// Items that share a line, in page order. `reach` is the largest bottom
+// edge of this and every earlier line, so it never decreases and the first
+// line crossing the viewport can be found by binary search.
+typedef struct {
+  int top;
+  int bottom;
+  int reach;
+  int first;
+  int count;
+} LineBox;
+
+// Position of layout between two tokens. Everything below depends only on
+// this state and the tokens that follow. `hidden` is the nesting depth
+// inside a display:none element. `reach` is the width the current block
+// has needed so far, see Checkpoint.
+typedef struct {
+  int cor_x;
+  int cor_y;
+  int last_width;
+  int last_height;
+  int max_width;
+  bool new_line;
+  int hidden;
+  char *prefix;
+  char *indent;
+  int font_size;
+  int reach;
+} LayoutState;
+
+// Layout state just before the block start tag at `token_index`, where the
+// first `item_count` items had been emitted. `reach` is the max-content
+// width of the block up to the next checkpoint: the narrowest width inside
+// the window padding at which it breaks no line. It is BLOCK_WRAPPED when
+// the block broke a line, and BLOCK_OPEN until the next block starts.
+typedef struct {
+  int token_index;
+  int item_count;
+  int reach;
+  LayoutState state;
+} Checkpoint;
+
+// Result of laying out a document at a given width. Coordinates are page
+// coordinates and already include the window padding.
+typedef struct {
+  DisplayItem *items;
+  int count;
+  int capacity;
+  LineBox *lines;
+  int line_count;
+  int line_capacity;
+  int width;
+  int height;
+  int layout_width;
+  unsigned generation;
+  Checkpoint *checkpoints;
+  int checkpoint_count;
+  int checkpoint_capacity;
+  int token_count;
+  LayoutState end_state;
+} DisplayList;
+
+void layout_document(DisplayList *list, Token *token, Token *last,
+                     int width);
+
+void extend_layout(DisplayList *list, Token *token, Token *last,
+                   int *changed_top);
+
+void update_layout(DisplayList *list, Token *token, TokenDiff *diff,
+                   int *changed_top, int *changed_bottom);
+
+void resize_layout(DisplayList *list, Document *document, int width);
+
+int find_first_line(DisplayList *list, int top);
+
+void clear_display_list(DisplayList *list);
+
+void free_display_list(DisplayList *list);
+
+#endif
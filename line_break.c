@@ -0,0 +1,262 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "line_break.h"
+#include "parser.h"
+#include "scan.h"
+
+typedef struct {
+  Uint32 first;
+  Uint32 last;
+  BreakClass break_class;
+} BreakRange;
+
+// 後の範囲が前の範囲を上書きする。載っていない文字は LB_ALPHA
+static const BreakRange break_ranges[] = {
+    {0x0300, 0x036F, LB_COMBINING},
+    {0x1100, 0x115F, LB_IDEOGRAPH},
+    {0x2026, 0x2026, LB_CLOSE},
+    {0x2E80, 0x2FFF, LB_IDEOGRAPH},
+    {0x3000, 0x303F, LB_IDEOGRAPH},
+    {0x3001, 0x3002, LB_CLOSE},
+    {0x3005, 0x3005, LB_CLOSE},
+    {0x3008, 0x3008, LB_OPEN},
+    {0x3009, 0x3009, LB_CLOSE},
+    {0x300A, 0x300A, LB_OPEN},
+    {0x300B, 0x300B, LB_CLOSE},
+    {0x300C, 0x300C, LB_OPEN},
+    {0x300D, 0x300D, LB_CLOSE},
+    {0x300E, 0x300E, LB_OPEN},
+    {0x300F, 0x300F, LB_CLOSE},
+    {0x3010, 0x3010, LB_OPEN},
+    {0x3011, 0x3011, LB_CLOSE},
+    {0x3014, 0x3014, LB_OPEN},
+    {0x3015, 0x3015, LB_CLOSE},
+    {0x3016, 0x3016, LB_OPEN},
+    {0x3017, 0x3017, LB_CLOSE},
+    {0x3018, 0x3018, LB_OPEN},
+    {0x3019, 0x3019, LB_CLOSE},
+    {0x301A, 0x301A, LB_OPEN},
+    {0x301B, 0x301B, LB_CLOSE},
+    {0x301D, 0x301D, LB_OPEN},
+    {0x301E, 0x301F, LB_CLOSE},
+    {0x3040, 0x30FF, LB_IDEOGRAPH},
+    {0x3041, 0x3041, LB_CLOSE},
+    {0x3043, 0x3043, LB_CLOSE},
+    {0x3045, 0x3045, LB_CLOSE},
+    {0x3047, 0x3047, LB_CLOSE},
+    {0x3049, 0x3049, LB_CLOSE},
+    {0x3063, 0x3063, LB_CLOSE},
+    {0x3083, 0x3083, LB_CLOSE},
+    {0x3085, 0x3085, LB_CLOSE},
+    {0x3087, 0x3087, LB_CLOSE},
+    {0x308E, 0x308E, LB_CLOSE},
+    {0x3095, 0x3096, LB_CLOSE},
+    {0x3099, 0x309A, LB_COMBINING},
+    {0x309B, 0x30A0, LB_CLOSE},
+    {0x30A1, 0x30A1, LB_CLOSE},
+    {0x30A3, 0x30A3, LB_CLOSE},
+    {0x30A5, 0x30A5, LB_CLOSE},
+    {0x30A7, 0x30A7, LB_CLOSE},
+    {0x30A9, 0x30A9, LB_CLOSE},
+    {0x30C3, 0x30C3, LB_CLOSE},
+    {0x30E3, 0x30E3, LB_CLOSE},
+    {0x30E5, 0x30E5, LB_CLOSE},
+    {0x30E7, 0x30E7, LB_CLOSE},
+    {0x30EE, 0x30EE, LB_CLOSE},
+    {0x30F5, 0x30F6, LB_CLOSE},
+    {0x30FB, 0x30FE, LB_CLOSE},
+    {0x3100, 0x31EF, LB_IDEOGRAPH},
+    {0x31F0, 0x31FF, LB_CLOSE},
+    {0x3200, 0x4DBF, LB_IDEOGRAPH},
+    {0x4E00, 0x9FFF, LB_IDEOGRAPH},
+    {0xA000, 0xA4CF, LB_IDEOGRAPH},
+    {0xAC00, 0xD7A3, LB_IDEOGRAPH},
+    {0xF900, 0xFAFF, LB_IDEOGRAPH},
+    {0xFE30, 0xFE4F, LB_IDEOGRAPH},
+    {0xFF01, 0xFF60, LB_IDEOGRAPH},
+    {0xFF01, 0xFF01, LB_CLOSE},
+    {0xFF08, 0xFF08, LB_OPEN},
+    {0xFF09, 0xFF09, LB_CLOSE},
+    {0xFF0C, 0xFF0C, LB_CLOSE},
+    {0xFF0E, 0xFF0E, LB_CLOSE},
+    {0xFF1A, 0xFF1B, LB_CLOSE},
+    {0xFF1F, 0xFF1F, LB_CLOSE},
+    {0xFF3B, 0xFF3B, LB_OPEN},
+    {0xFF3D, 0xFF3D, LB_CLOSE},
+    {0xFF5B, 0xFF5B, LB_OPEN},
+    {0xFF5D, 0xFF5D, LB_CLOSE},
+    {0xFF5F, 0xFF5F, LB_OPEN},
+    {0xFF60, 0xFF61, LB_CLOSE},
+    {0xFF62, 0xFF62, LB_OPEN},
+    {0xFF63, 0xFF65, LB_CLOSE},
+    {0xFFE0, 0xFFE6, LB_IDEOGRAPH},
+};
+
+// Classes of the BMP: break_index[codepoint >> 8] selects one of the
+// distinct 256-entry blocks.
+uint8_t break_index[256];
+uint8_t break_blocks[LB_BLOCK_LIMIT][256];
+uint8_t ascii_classes[128];
+int break_block_count;
+
+// Builds the two-stage class table of the BMP from break_ranges.
+void init_line_breaks() {
+  if (break_block_count > 0) {
+    return;
+  }
+  int range_count = sizeof(break_ranges) / sizeof(break_ranges[0]);
+  for (int high = 0; high < 256; high++) {
+    uint8_t block[256];
+    memset(block, LB_ALPHA, sizeof(block));
+    for (int i = 0; i < range_count; i++) {
+      const BreakRange *range = &break_ranges[i];
+      for (Uint32 c = range->first; c <= range->last; c++) {
+        if ((c >> 8) == (Uint32)high) {
+          block[c & 0xFF] = range->break_class;
+        }
+      }
+    }
+    int found = 0;
+    while (found < break_block_count &&
+           memcmp(break_blocks[found], block, sizeof(block)) != 0) {
+      found++;
+    }
+    if (found == break_block_count) {
+      if (break_block_count == LB_BLOCK_LIMIT) {
+        error("改行位置の分類表が大きすぎます\n");
+      }
+      memcpy(break_blocks[break_block_count++], block, sizeof(block));
+    }
+    break_index[high] = found;
+  }
+
+  for (int c = 0; c < 128; c++) {
+    ascii_classes[c] = LB_ALPHA;
+  }
+  ascii_classes[' '] = LB_SPACE;
+  for (char *p = "([{"; *p; p++) {
+    ascii_classes[(int)*p] = LB_OPEN;
+  }
+  for (char *p = ")]},.:;!?%"; *p; p++) {
+    ascii_classes[(int)*p] = LB_CLOSE;
+  }
+}
+
+BreakClass break_class(Uint32 codepoint) {
+  if (codepoint < 128) {
+    return ascii_classes[codepoint];
+  }
+  if (codepoint < 0x10000) {
+    return break_blocks[break_index[codepoint >> 8]][codepoint & 0xFF];
+  }
+  // 補助面は漢字と絵文字だけを区別する
+  if ((codepoint >= 0x1F000 && codepoint <= 0x1FAFF) ||
+      (codepoint >= 0x20000 && codepoint <= 0x3FFFF)) {
+    return LB_IDEOGRAPH;
+  }
+  return LB_ALPHA;
+}
+
+// Whether a line may start at a character of class `next` that follows
+// one of class `previous`. `before_space` is the class of the last
+// character before the spaces when `previous` is a space.
+bool can_break(BreakClass previous, BreakClass before_space,
+               BreakClass next) {
+  if (next == LB_SPACE || next == LB_CLOSE || next == LB_COMBINING) {
+    return false;
+  }
+  if (previous == LB_SPACE) {
+    return before_space != LB_OPEN;
+  }
+  if (previous == LB_OPEN) {
+    return false;
+  }
+  return previous == LB_IDEOGRAPH || next == LB_IDEOGRAPH;
+}
+
+// Decodes one UTF-8 sequence at `*p` and advances past it. Malformed input
+// yields U+FFFD and consumes a single byte.
+Uint32 decode_utf8(char **p) {
+  unsigned char *s = (unsigned char *)*p;
+  Uint32 c = s[0];
+  int length = 1;
+  if (c >= 0xF8) {
+    *p += 1;
+    return 0xFFFD;
+  } else if (c >= 0xF0) {
+    c &= 0x07;
+    length = 4;
+  } else if (c >= 0xE0) {
+    c &= 0x0F;
+    length = 3;
+  } else if (c >= 0xC2 && c < 0xE0) {
+    c &= 0x1F;
+    length = 2;
+  } else if (c >= 0x80) {
+    *p += 1;
+    return 0xFFFD;
+  }
+  for (int i = 1; i < length; i++) {
+    if ((s[i] & 0xC0) != 0x80) {
+      *p += 1;
+      return 0xFFFD;
+    }
+    c = (c << 6) | (s[i] & 0x3F);
+  }
+  *p += length;
+  return c;
+}
+
+// Stores in `breaks` the offsets of the characters of `text` where a new
+// line may start and returns how many there are. The text must have its
+// spaces collapsed, and `breaks` must have room for `length` offsets.
+// Offset 0 is never stored. ASCII spans can only break after a space, so
+// they are skipped a word at a time.
+int find_line_breaks(char *text, int length, int *breaks) {
+  char *p = text;
+  char *end = text + length;
+  int count = 0;
+  BreakClass previous = LB_OPEN;
+  BreakClass before_space = LB_OPEN;
+  while (p < end) {
+    char *ascii_end = scan_non_ascii(p, end);
+    while (p < ascii_end) {
+      BreakClass next = ascii_classes[(unsigned char)*p];
+      if (can_break(previous, before_space, next)) {
+        breaks[count++] = (int)(p - text);
+      }
+      if (next == LB_SPACE) {
+        if (previous != LB_SPACE) {
+          before_space = previous;
+        }
+        previous = LB_SPACE;
+        p++;
+      } else {
+        // 単語の途中では改行できない
+        p = scan_byte(p, ascii_end, ' ');
+        previous = ascii_classes[(unsigned char)p[-1]];
+      }
+    }
+    while (p < end && (unsigned char)*p >= 0x80) {
+      char *start = p;
+      BreakClass next = break_class(decode_utf8(&p));
+      if (can_break(previous, before_space, next)) {
+        breaks[count++] = (int)(start - text);
+      }
+      // 結合文字は前の文字の分類を引き継ぐ。全角の閉じ括弧や小書きの仮名の
+      // 後ろは漢字の後ろと同じく改行できる
+      if (next == LB_CLOSE) {
+        previous = LB_IDEOGRAPH;
+      } else if (next != LB_COMBINING) {
+        previous = next;
+      }
+    }
+  }
+  return count;
+}
@@ -0,0 +1,32 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <SDL2/SDL.h>
+
+#ifndef BROWSER_LINE_BREAK_H
+#define BROWSER_LINE_BREAK_H
+
+// Line breaking class of a character, a small subset of UAX #14. Closing
+// punctuation also covers the characters that must not start a line, such
+// as small kana and the prolonged sound mark.
+typedef enum {
+  LB_ALPHA,
+  LB_SPACE,
+  LB_IDEOGRAPH,
+  LB_OPEN,
+  LB_CLOSE,
+  LB_COMBINING,
+} BreakClass;
+
+// BMP の分類表は 256 文字ずつのブロックに分け、同じ内容のブロックは共有する
+#define LB_BLOCK_LIMIT 64
+
+Uint32 decode_utf8(char **p);
+
+void init_line_breaks();
+
+BreakClass break_class(Uint32 codepoint);
+
+int find_line_breaks(char *text, int length, int *breaks);
+
+#endif
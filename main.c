@@ -1,234 +1,161 @@
 
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <limits.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
+#include "atlas.h"
+#include "fonts.h"
+#include "layout.h"
 #include "parser.h"
+#include "raster_pool.h"
+#include "render.h"
+#include "texture_cache.h"
+#include "watch.h"
+#include "word_cache.h"
 
-SDL_Window *window;
-SDL_Renderer *renderer;
-
-TTF_Font *font_p;
-TTF_Font *font_h1;
-TTF_Font *font_h2;
-TTF_Font *font_h3;
-
-typedef struct {
-  SDL_Texture *textTexture;
-  int width;
-  int height;
-} WidgetCache;
-
-WidgetCache caches[MAX_TAGS];
-
-const int win_padding_x = 20;
-const int win_padding_y = 20;
-const int line_space = 10;
 const int scroll_step = 20;
-int window_height = 480;
-int window_width = 720;
-
-const int font_size_p = 16;
-const int font_size_h1 = 48;
-const int font_size_h2 = 32;
-const int font_size_h3 = 20;
-
-int scroll_width = 0;
-int scroll_height = 0;
-
-int scroll_offset_x = 0;
-int scroll_offset_y = 0;
-
-int changed = true;
+const int idle_wait = 1000;
+const Uint32 frame_interval = 16;
+const Uint32 relayout_interval = 100;
+
+bool vsync = false;
+
+DisplayList display_list;
+// display_list が並べ終えた最後のトークン。NULL なら最初から並べ直す
+Token *layout_end;
+
+// Lays out the tokens published since the last call and updates the
+// scrollable area. Only rows from the old end of the page down are
+// repainted.
+void relayout(Document *document) {
+  bool done;
+  Token *last = published_tokens(document, &done);
+  if (layout_end == NULL) {
+    layout_document(&display_list, last ? document->token : NULL, last,
+                    window_width);
+  } else if (last != layout_end) {
+    int top;
+    extend_layout(&display_list, layout_end, last, &top);
+    invalidate_tile_rows(top, INT_MAX);
+  }
+  layout_end = last;
+  scroll_width = display_list.width;
+  scroll_height = display_list.height;
+  char *title = document_title(document);
+  if (title != NULL) {
+    SDL_SetWindowTitle(window, title);
+  }
+}
 
-void quit_sdl() {
-  SDL_DestroyWindow(window);
-  SDL_DestroyRenderer(renderer);
-  SDL_DestroyWindow(window);
-  TTF_Quit();
-  SDL_Quit();
+// Reads `file_name` again and starts tokenizing it on a worker thread as
+// `*pending`, replacing a reload that has not finished yet. The current
+// page stays on screen until finish_reload().
+void reload(Document **pending, char *file_name, Uint32 event_type) {
+  size_t length;
+  char *source = try_read_file(file_name, &length);
+  if (source == NULL) {
+    return;
+  }
+  if (*pending != NULL) {
+    free_document(*pending);
+  }
+  *pending = new_document(source, length);
+  start_tokenizer(*pending, event_type);
 }
 
-void draw_window(Token *token) {
-  SDL_Surface *textSurface;
-  SDL_Texture *textTexture;
-  int width, height;
-  int index = 0;
-  int cor_x = 0;
-  int cor_y = 0;
-  int last_width = 0;
-  int last_height = 0;
-  int max_width = 0;
-  bool new_line = true;
-  bool is_title = false;
-  char prefix[10] = "";
-  char indent[10] = "";
-  int font_style = TTF_STYLE_NORMAL;
-  TTF_Font *font = font_p;
-
-  SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-  SDL_RenderClear(renderer);
-
-  while (token->kind != TK_EOF) {
-    new_line = ((token->css_property->display == DISPLAY_BLOCK) || new_line);
-    switch (token->kind) {
-    case START_TAG:
-      // printf("START_TAG: %s\n", tag_names[token->tag]);
-      switch (token->tag) {
-      case TAG_TITLE:
-        is_title = true;
-        break;
-      case TAG_H1:
-        last_height += 20;
-        font = font_h1;
-        break;
-      case TAG_H2:
-        last_height += 15;
-        font = font_h2;
-        break;
-      case TAG_H3:
-        last_height += 10;
-        font = font_h3;
-        break;
-      case TAG_P:
-        font = font_p;
-        break;
-      case TAG_LI:
-        strcpy(prefix, "  * ");
-        strcpy(indent, "    ");
-        break;
-      default:
-        break;
-      }
-      break;
-    case START_TAG_ONLY:
-      // printf("START_TAG_ONLY: %s\n", tag_names[token->tag]);
-      switch (token->tag) {
-      case TAG_BR:
-        cor_x = 0;
-        cor_y += last_height + line_space;
-        new_line = true;
-        break;
-
-      default:
-        break;
-      }
-      break;
-    case END_TAG:
-      // printf("END_TAG: %s\n", tag_names[token->tag]);
-      new_line = (token->css_property->display == DISPLAY_BLOCK);
-      if ((token->tag == TAG_H1) || (token->tag == TAG_H2) ||
-          (token->tag == TAG_H3) || (token->tag == TAG_P)) {
-        font = font_p;
-      } else if (token->tag == TAG_TITLE) {
-        is_title = false;
-      } else if (token->tag == TAG_LI) {
-        prefix[0] = '\0';
-        indent[0] = '\0';
-      }
-      break;
-    case PLAIN_TEXT:
-      // printf("PLAIN_TEXT: \"%s\"\n", token->text);
-      if (is_title) {
-        SDL_SetWindowTitle(window, token->text);
-        break;
-      }
-      index += 1;
-      if (new_line) {
-        cor_x = 0;
-        cor_y += last_height;
-        new_line = false;
-      } else {
-        cor_x += last_width;
-      }
-      if (prefix[0] != '\0') {
-        TTF_SetFontStyle(font, TTF_STYLE_BOLD);
-        textSurface =
-            TTF_RenderUTF8_Blended(font, prefix, (SDL_Color){0, 0, 0});
-        textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-        SDL_QueryTexture(textTexture, NULL, NULL, &width, &height);
-        SDL_Rect dstrect = {win_padding_x + cor_x - scroll_offset_x,
-                            win_padding_y + cor_y - scroll_offset_y, width,
-                            height};
-        SDL_RenderCopy(renderer, textTexture, NULL, &dstrect);
-        SDL_FreeSurface(textSurface);
-        cor_x += width;
-        prefix[0] = '\0';
-      } else if (indent[0] != '\0') {
-        textSurface =
-            TTF_RenderUTF8_Blended(font, indent, (SDL_Color){0, 0, 0});
-        textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-        SDL_QueryTexture(textTexture, NULL, NULL, &width, &height);
-        SDL_Rect dstrect = {win_padding_x + cor_x - scroll_offset_x,
-                            win_padding_y + cor_y - scroll_offset_y, width,
-                            height};
-        SDL_RenderCopy(renderer, textTexture, NULL, &dstrect);
-        SDL_FreeSurface(textSurface);
-        cor_x += width;
-      }
-      if (!caches[index].textTexture && !changed) {
-        textTexture = caches[index].textTexture;
-        width = caches[index].width;
-        height = caches[index].height;
-        SDL_Rect dstrect = {win_padding_x + cor_x - scroll_offset_x,
-                            win_padding_y + cor_y - scroll_offset_y, width,
-                            height};
-        SDL_RenderCopy(renderer, textTexture, NULL, &dstrect);
-        last_width = width;
-        last_height = height + line_space;
-        break;
-      }
-      font_style = TTF_STYLE_NORMAL;
-      if (token->css_property->font_weight == FONT_BOLD) {
-        font_style |= TTF_STYLE_BOLD;
-      }
-      if (token->css_property->font_style == FONT_ITALIC) {
-        font_style |= TTF_STYLE_ITALIC;
-      }
-      if (token->css_property->text_decoration == TEXT_UNDERLINE) {
-        font_style |= TTF_STYLE_UNDERLINE;
-      }
-      TTF_SetFontStyle(font, font_style);
-      textSurface =
-          TTF_RenderUTF8_Blended(font, token->text, token->css_property->color);
-      textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-      SDL_QueryTexture(textTexture, NULL, NULL, &width, &height);
-      SDL_Rect dstrect = {win_padding_x + cor_x - scroll_offset_x,
-                          win_padding_y + cor_y - scroll_offset_y, width,
-                          height};
-      SDL_RenderCopy(renderer, textTexture, NULL, &dstrect);
-      SDL_FreeSurface(textSurface);
-      max_width = (cor_x + width) > max_width ? (cor_x + width) : max_width;
-      last_width = width;
-      last_height = height + line_space;
-      caches[index] = (WidgetCache){textTexture, width, height};
-      break;
-    default:
-      break;
-    }
-    token = token->next;
+// Replaces `*document` with the fully tokenized `*pending` and lays out
+// only what changed. A version that failed to tokenize is dropped instead. Tiles outside the changed rows and every rasterized
+// glyph are kept.
+void finish_reload(Document **document, Document **pending) {
+  Document *next = *pending;
+  *pending = NULL;
+  if (next->failed) {
+    // 読めなかった版は捨て、表示中の文書を残す
+    warning("再読み込みに失敗したので、前の内容を表示し続けます\n");
+    free_document(next);
+    return;
+  }
+  bool done;
+  published_tokens(*document, &done);
+  if (!done) {
+    // 読み込みの途中なら差分は取らずにやり直す
+    free_document(*document);
+    *document = next;
+    layout_end = NULL;
+    relayout(next);
+    return;
+  }
+  TokenDiff diff;
+  int top, bottom;
+  diff_tokens((*document)->token, next->token, &diff);
+  update_layout(&display_list, next->token, &diff, &top, &bottom);
+  invalidate_tile_rows(top, bottom);
+  free_document(*document);
+  *document = next;
+  layout_end = published_tokens(next, &done);
+  scroll_width = display_list.width;
+  scroll_height = display_list.height;
+  char *title = document_title(next);
+  if (title != NULL) {
+    SDL_SetWindowTitle(window, title);
   }
+}
 
-  scroll_width = max_width + win_padding_x * 2;
-  scroll_height = cor_y + last_height + win_padding_y * 2;
+// Lays out the page again for a new window width. Once the whole document
+// is laid out, blocks whose line breaks do not change are reused.
+void resize(Document *document) {
+  bool done;
+  published_tokens(document, &done);
+  // 文書の数には TK_EOF も入っている
+  if (!done || display_list.token_count + 1 != (int)document->token_count) {
+    layout_end = NULL;
+    relayout(document);
+    return;
+  }
+  resize_layout(&display_list, document, window_width);
+  scroll_width = display_list.width;
+  scroll_height = display_list.height;
+}
 
-  SDL_RenderPresent(renderer);
+void clamp_scroll() {
+  if (scroll_offset_x <= 0 || scroll_width < window_width) {
+    scroll_offset_x = 0;
+  } else if (scroll_offset_x > scroll_width - window_width) {
+    scroll_offset_x = scroll_width - window_width;
+  }
 
-  changed = false;
+  if (scroll_offset_y <= 0 || scroll_height < window_height) {
+    scroll_offset_y = 0;
+  } else if (scroll_offset_y > scroll_height - window_height) {
+    scroll_offset_y = scroll_height - window_height;
+  }
 }
 
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
+  // -w を付けるとファイルの保存を監視して再読み込みする
+  bool watch = argc == 3 && strcmp(argv[1], "-w") == 0;
+  if (argc != 2 && !watch) {
     error("引数の個数が正しくありません\n");
   }
-  Token *token = parse_html(argv[1]);
+  char *file_name = argv[argc - 1];
+  size_t length;
+  char *source = read_file(file_name, &length);
+  Document *document = new_document(source, length);
+
+  // テクスチャ予算 (MB) は環境変数で変更できる
+  char *budget = getenv("LSB_TEXTURE_BUDGET_MB");
+  if (budget != NULL && atoi(budget) > 0) {
+    texture_cache.budget = (size_t)atoi(budget) * 1024 * 1024;
+  }
 
   // SDLの初期化
   if (SDL_Init(SDL_INIT_VIDEO) != 0) {
@@ -243,7 +170,8 @@ int main(int argc, char *argv[]) {
   // ウィンドウを作成
   window =
       SDL_CreateWindow("LSB", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                       window_width, window_height, SDL_WINDOW_SHOWN);
+                       window_width, window_height,
+                       SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
   SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "2");
   if (!window) {
     error("SDL_CreateWindow Error: %s\n", SDL_GetError());
@@ -259,103 +187,162 @@ int main(int argc, char *argv[]) {
   }
 
   // レンダラーを作成
-  renderer = SDL_CreateRenderer(window, -2, SDL_RENDERER_ACCELERATED);
-  SDL_SetRenderDrawColor(renderer, 255, 255, 255, 0);
+  // 描画は垂直同期に合わせる。使えなければ同期なしで作り直す
+  renderer = SDL_CreateRenderer(
+      window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+  if (!renderer) {
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+  }
   if (!renderer) {
     error("SDL_CreateRenderer Error: %s\n", SDL_GetError());
   }
+  SDL_RendererInfo info;
+  if (SDL_GetRendererInfo(renderer, &info) == 0) {
+    vsync = (info.flags & SDL_RENDERER_PRESENTVSYNC) != 0;
+  }
+  SDL_SetRenderDrawColor(renderer, 255, 255, 255, 0);
 
   // フォントを開く
-  char *font_path = "./RictyDiminished.ttf";
-  font_p = TTF_OpenFont(font_path, font_size_p);
-  font_h1 = TTF_OpenFont(font_path, font_size_h1);
-  font_h2 = TTF_OpenFont(font_path, font_size_h2);
-  font_h3 = TTF_OpenFont(font_path, font_size_h3);
-  if (!font_p || !font_h1 || !font_h2 || !font_h3) {
-    error("TTF_OpenFont Error: %s\n", TTF_GetError());
+  open_fonts("./RictyDiminished.ttf");
+  start_raster_pool();
+
+  // トークナイズは別スレッドで進め、出来たところから表示する
+  Uint32 parse_event = SDL_RegisterEvents(1);
+  if (parse_event == (Uint32)-1) {
+    error("SDL_RegisterEvents Error: %s\n", SDL_GetError());
   }
+  start_tokenizer(document, parse_event);
 
-  for (int i = 0; i < MAX_TAGS; i++) {
-    caches[i] = (WidgetCache){NULL, 0, 0};
+  // 保存の通知と、読み直した文書のトークナイズの進み具合
+  Uint32 reload_event = SDL_RegisterEvents(2);
+  Uint32 reload_parse_event = reload_event + 1;
+  if (watch && reload_event != (Uint32)-1) {
+    start_file_watch(file_name, reload_event);
   }
-  draw_window(token);
+  Document *pending = NULL;
+
+  relayout(document);
+  draw_window(&display_list);
 
   bool running = true;
-  bool changed = true;
+  bool changed = false;
+  bool modified = false;
+  int wheel_x = 0;
+  int wheel_y = 0;
+  Uint32 last_frame = SDL_GetTicks();
+  Uint32 last_layout = last_frame;
   SDL_Event event;
 
+  bool prefetching = false;
+
   while (running) {
-    SDL_PollEvent(&event);
-    if (event.type == SDL_WINDOWEVENT) {
-      if (event.window.event == SDL_WINDOWEVENT_CLOSE) {
+    // 描画するものがなければイベントが来るまで眠る。
+    // 先読みが残っていれば待たずに1タイルずつ進める
+    if (!SDL_WaitEventTimeout(&event, prefetching ? 0 : idle_wait)) {
+      if (prefetching) {
+        prefetching = prefetch_tile(&display_list);
+      }
+      continue;
+    }
+    // 溜まっているイベントはまとめて処理し、描画は1回にする
+    do {
+      if (event.type == SDL_QUIT) {
         running = false;
-      } else if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
-        window_width = event.window.data1;
-        window_height = event.window.data2;
-
-        if (scroll_offset_x <= 0 || scroll_width < window_width) {
-          scroll_offset_x = 0;
-        } else if (scroll_offset_x > scroll_width - window_width) {
-          scroll_offset_x = scroll_width - window_width;
+      } else if (event.type == SDL_WINDOWEVENT) {
+        if (event.window.event == SDL_WINDOWEVENT_CLOSE) {
+          running = false;
+        } else if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
+          // レイアウトは幅が変わったときだけやり直す
+          if (event.window.data1 != window_width) {
+            window_width = event.window.data1;
+            resize(document);
+          }
+          window_height = event.window.data2;
+          SDL_RenderSetLogicalSize(renderer, window_width, window_height);
+          changed = true;
+        } else if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+          changed = true;
         }
-
-        if (scroll_offset_y <= 0 || scroll_height < window_height) {
-          scroll_offset_y = 0;
-        } else if (scroll_offset_y > scroll_height - window_height) {
-          scroll_offset_y = scroll_height - window_height;
+      } else if (event.type == parse_event) {
+        // 最初の画面が埋まるまでは毎回、その後は一定間隔でレイアウトする
+        bool done;
+        published_tokens(document, &done);
+        if (done || display_list.height < window_height ||
+            SDL_GetTicks() - last_layout >= relayout_interval) {
+          relayout(document);
+          last_layout = SDL_GetTicks();
+          changed = true;
         }
-
-        // printf("window_width: %d, window_height: %d\n", window_width,
-        // window_height);
-        SDL_RenderSetLogicalSize(renderer, window_width, window_height);
+      } else if (event.type == reload_event) {
+        // 続けて保存されても読み直すのは1回にする
+        modified = true;
+      } else if (event.type == reload_parse_event) {
+        // 読み直した文書は最後までトークナイズしてから差し替える
+        bool done = false;
+        if (pending != NULL) {
+          published_tokens(pending, &done);
+        }
+        if (done) {
+          finish_reload(&document, &pending);
+          changed = true;
+        }
+      } else if (event.type == SDL_RENDER_TARGETS_RESET) {
+        // レンダーターゲットの中身が失われたのでタイルを描き直す
+        invalidate_tiles();
         changed = true;
+      } else if (event.type == SDL_MOUSEWHEEL) {
+        // ホイールの移動量は捨てずに足し合わせる
+        wheel_x += event.wheel.x;
+        wheel_y += event.wheel.y;
       }
-    }
-
-    if (event.type == SDL_MOUSEWHEEL) {
-      if (event.wheel.x < 0) {
-        scroll_offset_x -= scroll_step;
-      } else if (event.wheel.x > 0) {
-        scroll_offset_x += scroll_step;
-      }
-
-      if (event.wheel.y < 0) {
-        scroll_offset_y += scroll_step;
-      } else if (event.wheel.y > 0) {
-        scroll_offset_y -= scroll_step;
-      }
-
-      if (scroll_offset_x <= 0 || scroll_width < window_width) {
-        scroll_offset_x = 0;
-      } else if (scroll_offset_x > scroll_width - window_width) {
-        scroll_offset_x = scroll_width - window_width;
-      }
+    } while (SDL_PollEvent(&event));
 
-      if (scroll_offset_y <= 0 || scroll_height < window_height) {
-        scroll_offset_y = 0;
-      } else if (scroll_offset_y > scroll_height - window_height) {
-        scroll_offset_y = scroll_height - window_height;
-      }
+    if (!running) {
+      break;
+    }
 
-      while (SDL_PollEvent(&event)) {
-        continue;
-      }
+    if (modified) {
+      reload(&pending, file_name, reload_parse_event);
+      modified = false;
+    }
 
+    if (wheel_x != 0 || wheel_y != 0) {
+      scroll_offset_x += wheel_x * scroll_step;
+      scroll_offset_y -= wheel_y * scroll_step;
+      track_scroll(wheel_x * scroll_step, -wheel_y * scroll_step);
+      wheel_x = 0;
+      wheel_y = 0;
       changed = true;
     }
 
     if (changed) {
-      draw_window(token);
+      clamp_scroll();
+      // vsync が無いときは描画間隔をリフレッシュレート程度に抑える
+      if (!vsync) {
+        Uint32 elapsed = SDL_GetTicks() - last_frame;
+        if (elapsed < frame_interval) {
+          SDL_Delay(frame_interval - elapsed);
+        }
+      }
+      draw_window(&display_list);
+      last_frame = SDL_GetTicks();
       changed = false;
+      prefetching = true;
     }
-
-    SDL_Delay(20);
   }
 
-  TTF_CloseFont(font_p);
-  TTF_CloseFont(font_h1);
-  TTF_CloseFont(font_h2);
-  TTF_CloseFont(font_h3);
+  stop_file_watch();
+  free_display_list(&display_list);
+  free_tiles();
+  free_glyph_atlases();
+  stop_raster_pool();
+  free_texture_cache();
+  free_word_cache();
+  close_fonts();
+  if (pending != NULL) {
+    free_document(pending);
+  }
+  free_document(document);
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
   TTF_Quit();
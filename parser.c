@@ -1,6 +1,9 @@
 
 #define _CRT_SECURE_NO_WARNINGS
+#include "entity.h"
+#include "line_break.h"
 #include "parser.h"
+#include "scan.h"
 
 #include <ctype.h>
 #include <stdarg.h>
@@ -9,10 +12,129 @@
 #include <stdlib.h>
 #include <string.h>
 
-char user_input[80000];
-Token *token;
-TagKind tag_stack[MAX_TAGS];
-int tag_count = 0;
+static const CssProperty initial_style = {
+    {0, 0, 0}, 100, FONT_NORMAL, FONT_NORMAL, TEXT_NONE, DISPLAY_BLOCK};
+
+// タグごとの既定のスタイル (`set` に含まれない値は親から継承する)
+static const TagStyle tag_styles[sizeof(tag_names) / sizeof(tag_names[0])] = {
+    [TAG_DIV] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_SPAN] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_STRONG] = {STYLE_FONT_WEIGHT,
+                    {.font_weight = FONT_BOLD, .display = DISPLAY_INLINE}},
+    [TAG_IMG] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_TITLE] = {0, {.display = DISPLAY_NONE}},
+    [TAG_SECTION] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_PRE] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_SCRIPT] = {0, {.display = DISPLAY_NONE}},
+    [TAG_P] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_A] = {STYLE_COLOR | STYLE_TEXT_DECORATION,
+               {.color = {0, 0, 255},
+                .text_decoration = TEXT_UNDERLINE,
+                .display = DISPLAY_INLINE}},
+    [TAG_H1] = {STYLE_FONT_WEIGHT,
+                {.font_weight = FONT_BOLD, .display = DISPLAY_BLOCK}},
+    [TAG_H2] = {STYLE_FONT_WEIGHT,
+                {.font_weight = FONT_BOLD, .display = DISPLAY_BLOCK}},
+    [TAG_H3] = {STYLE_FONT_WEIGHT,
+                {.font_weight = FONT_BOLD, .display = DISPLAY_BLOCK}},
+    [TAG_UL] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_LI] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_EM] = {STYLE_FONT_STYLE,
+                {.font_style = FONT_ITALIC, .display = DISPLAY_INLINE}},
+    [TAG_BR] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_HTML] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_HEAD] = {0, {.display = DISPLAY_NONE}},
+    [TAG_BODY] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_HEADER] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_FOOTER] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_NAV] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_MAIN] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_ARTICLE] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_ASIDE] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_H4] = {STYLE_FONT_WEIGHT,
+                {.font_weight = FONT_BOLD, .display = DISPLAY_BLOCK}},
+    [TAG_H5] = {STYLE_FONT_WEIGHT,
+                {.font_weight = FONT_BOLD, .display = DISPLAY_BLOCK}},
+    [TAG_H6] = {STYLE_FONT_WEIGHT,
+                {.font_weight = FONT_BOLD, .display = DISPLAY_BLOCK}},
+    [TAG_OL] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_BLOCKQUOTE] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_FIGURE] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_FIGCAPTION] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_ADDRESS] = {STYLE_FONT_STYLE,
+                     {.font_style = FONT_ITALIC, .display = DISPLAY_BLOCK}},
+    [TAG_DETAILS] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_SUMMARY] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_FORM] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_NOSCRIPT] = {0, {.display = DISPLAY_NONE}},
+    [TAG_TEMPLATE] = {0, {.display = DISPLAY_NONE}},
+    [TAG_STYLE] = {0, {.display = DISPLAY_NONE}},
+    [TAG_B] = {STYLE_FONT_WEIGHT,
+               {.font_weight = FONT_BOLD, .display = DISPLAY_INLINE}},
+    [TAG_I] = {STYLE_FONT_STYLE,
+               {.font_style = FONT_ITALIC, .display = DISPLAY_INLINE}},
+    [TAG_U] = {STYLE_TEXT_DECORATION,
+               {.text_decoration = TEXT_UNDERLINE, .display = DISPLAY_INLINE}},
+    [TAG_S] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_CODE] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_SMALL] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_MARK] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_SUB] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_SUP] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_ABBR] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_CITE] = {STYLE_FONT_STYLE,
+                  {.font_style = FONT_ITALIC, .display = DISPLAY_INLINE}},
+    [TAG_TIME] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_KBD] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_SAMP] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_VAR] = {STYLE_FONT_STYLE,
+                 {.font_style = FONT_ITALIC, .display = DISPLAY_INLINE}},
+    [TAG_Q] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_DFN] = {STYLE_FONT_STYLE,
+                 {.font_style = FONT_ITALIC, .display = DISPLAY_INLINE}},
+    [TAG_DEL] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_INS] = {STYLE_TEXT_DECORATION,
+                 {.text_decoration = TEXT_UNDERLINE,
+                  .display = DISPLAY_INLINE}},
+    [TAG_LABEL] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_BUTTON] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_HR] = {0, {.display = DISPLAY_BLOCK}},
+    [TAG_META] = {0, {.display = DISPLAY_NONE}},
+    [TAG_LINK] = {0, {.display = DISPLAY_NONE}},
+    [TAG_INPUT] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_WBR] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_BASE] = {0, {.display = DISPLAY_NONE}},
+    [TAG_SOURCE] = {0, {.display = DISPLAY_NONE}},
+    [TAG_TRACK] = {0, {.display = DISPLAY_NONE}},
+    [TAG_AREA] = {0, {.display = DISPLAY_NONE}},
+    [TAG_COL] = {0, {.display = DISPLAY_NONE}},
+    [TAG_EMBED] = {0, {.display = DISPLAY_INLINE}},
+    [TAG_PARAM] = {0, {.display = DISPLAY_NONE}}};
+
+// 終了タグを持たない要素と、中身をタグとして解釈しない要素
+static const unsigned char tag_flags[sizeof(tag_names) / sizeof(tag_names[0])] =
+    {[TAG_SCRIPT] = TAG_RAW_TEXT,
+     [TAG_STYLE] = TAG_RAW_TEXT,
+     [TAG_IMG] = TAG_VOID,
+     [TAG_BR] = TAG_VOID,
+     [TAG_HR] = TAG_VOID,
+     [TAG_META] = TAG_VOID,
+     [TAG_LINK] = TAG_VOID,
+     [TAG_INPUT] = TAG_VOID,
+     [TAG_WBR] = TAG_VOID,
+     [TAG_BASE] = TAG_VOID,
+     [TAG_SOURCE] = TAG_VOID,
+     [TAG_TRACK] = TAG_VOID,
+     [TAG_AREA] = TAG_VOID,
+     [TAG_COL] = TAG_VOID,
+     [TAG_EMBED] = TAG_VOID,
+     [TAG_PARAM] = TAG_VOID};
+
+static PerfectHash tag_hash;
+static PerfectHash attribute_hash;
+
+// プレーンテキストは親のスタイルをそのまま継承する
+static const TagStyle text_style = {0, {.display = DISPLAY_INLINE}};
 
 // Reports an error and exit.
 void error(char *fmt, ...) {
@@ -28,37 +150,240 @@ void warning(char *fmt, ...) {
   vfprintf(stdout, fmt, ap);
 }
 
-Token *new_token(TokenKind kind, Token *cur, Token *parent) {
-  Token *tok = calloc(1, sizeof(Token));
+// Returns `size` zeroed bytes from the arena. Small requests are carved out of
+// ARENA_BLOCK_SIZE blocks; larger ones get a block of their own.
+void *arena_alloc(Arena *arena, size_t size) {
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  ArenaBlock *block = arena->head;
+  if (block == NULL || block->capacity - block->used < size) {
+    size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = malloc(sizeof(ArenaBlock) + capacity);
+    if (block == NULL) {
+      error("メモリを確保できません\n");
+    }
+    block->used = 0;
+    block->capacity = capacity;
+    if (arena->head != NULL && capacity > ARENA_BLOCK_SIZE) {
+      // 大きな領域は現在のブロックの後ろにつなぎ、残りを使い続ける
+      block->next = arena->head->next;
+      arena->head->next = block;
+    } else {
+      block->next = arena->head;
+      arena->head = block;
+    }
+    arena->block_count++;
+    arena->reserved += sizeof(ArenaBlock) + capacity;
+  }
+  void *ptr = block->data + block->used;
+  block->used += size;
+  arena->used += size;
+  memset(ptr, 0, size);
+  return ptr;
+}
+
+// Copies `length` bytes of `str` into the arena and NUL-terminates them.
+char *arena_strndup(Arena *arena, char *str, size_t length) {
+  char *copy = arena_alloc(arena, length + 1);
+  memcpy(copy, str, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+void arena_free(Arena *arena) {
+  ArenaBlock *block = arena->head;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  *arena = (Arena){0};
+}
+
+Token *new_token(Document *document, TokenKind kind, Token *cur) {
+  Token *tok = arena_alloc(&document->arena, sizeof(Token));
   tok->kind = kind;
-  tok->parent = parent;
-  CssProperty *css_property = calloc(1, sizeof(CssProperty));
-  css_property->color = (SDL_Color){0, 0, 0};
-  css_property->font_size = 100;
-  css_property->font_weight = FONT_NORMAL;
-  css_property->font_style = FONT_NORMAL;
-  css_property->text_decoration = TEXT_NONE;
-  css_property->display = DISPLAY_BLOCK;
-  tok->css_property = css_property;
+  tok->index = document->token_count++;
   cur->next = tok;
   return tok;
 }
 
-bool startswith(char *p, char *q) { return memcmp(p, q, strlen(q)) == 0; }
+Node *node_at(Document *document, uint32_t index) {
+  return &document->node_chunks[index / NODE_CHUNK][index % NODE_CHUNK];
+}
 
-void stack_push(TagKind tag) {
-  tag_stack[tag_count++] = tag;
-  if (tag_count >= MAX_TAGS) {
+// Appends a node for `token` to the tree as the next child of `parent`
+// after `*previous`, which becomes the new node.
+uint32_t push_node(Document *document, Token *token, uint32_t parent,
+                   uint32_t *previous) {
+  uint32_t index = document->node_count++;
+  Node **chunk = &document->node_chunks[index / NODE_CHUNK];
+  if (*chunk == NULL) {
+    *chunk = arena_alloc(&document->arena, NODE_CHUNK * sizeof(Node));
+  }
+  Node *node = &(*chunk)[index % NODE_CHUNK];
+  node->token = token;
+  node->parent = parent;
+  node->first_child = NO_NODE;
+  node->next_sibling = NO_NODE;
+  if (parent != NO_NODE) {
+    if (*previous == NO_NODE) {
+      node_at(document, parent)->first_child = index;
+    } else {
+      node_at(document, *previous)->next_sibling = index;
+    }
+  }
+  *previous = index;
+  if (token != NULL) {
+    token->node = index;
+  }
+  return index;
+}
+
+// Returns the first node at or after the token at `token_index`, starting
+// from node `from`, which comes before it. Subtrees that end before the
+// token are skipped by their sibling links. Returns NO_NODE when no node
+// follows. Only for a document that is done tokenizing.
+uint32_t find_node(Document *document, uint32_t from, uint32_t token_index) {
+  uint32_t index = from;
+  while (index != NO_NODE) {
+    Node *node = node_at(document, index);
+    Token *token = node->token;
+    if (token != NULL && token->index >= token_index) {
+      return index;
+    }
+    // 探すトークンがこの要素の中にあれば子へ降りる
+    if (node->first_child != NO_NODE &&
+        (token == NULL || token->end == NULL ||
+         token->end->index > token_index)) {
+      index = node->first_child;
+      continue;
+    }
+    while (index != NO_NODE &&
+           node_at(document, index)->next_sibling == NO_NODE) {
+      index = node_at(document, index)->parent;
+    }
+    if (index != NO_NODE) {
+      index = node_at(document, index)->next_sibling;
+    }
+  }
+  return NO_NODE;
+}
+
+static uint32_t hash_name(uint32_t seed, char *name, int length) {
+  uint32_t hash = 2166136261u ^ seed;
+  for (int i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char)tolower((unsigned char)name[i])) * 16777619u;
+  }
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+// Tries seeds until every name lands in its own slot. A seed works with
+// probability about exp(-n^2 / (2 * PERFECT_HASH_SIZE)) for n names: the
+// 73 tag names need about two attempts, but near the UINT8_MAX cap it
+// takes a few thousand.
+void build_perfect_hash(PerfectHash *table, char **names, int count) {
+  if (count > UINT8_MAX) {
+    error("完全ハッシュに登録できる名前が多すぎます: %d\n", count);
+  }
+  table->names = names;
+  table->count = count;
+  for (uint32_t seed = 0;; seed++) {
+    memset(table->slots, 0, sizeof(table->slots));
+    int i;
+    for (i = 0; i < count; i++) {
+      uint32_t slot =
+          hash_name(seed, names[i], strlen(names[i])) % PERFECT_HASH_SIZE;
+      if (table->slots[slot] != 0) {
+        break;
+      }
+      table->slots[slot] = i + 1;
+    }
+    if (i == count) {
+      table->seed = seed;
+      return;
+    }
+  }
+}
+
+// Returns the index of the (case-insensitive) name, or -1.
+int lookup_perfect_hash(PerfectHash *table, char *name, int length) {
+  if (length == 0) {
+    return -1;
+  }
+  uint32_t slot = hash_name(table->seed, name, length) % PERFECT_HASH_SIZE;
+  int index = table->slots[slot] - 1;
+  if (index < 0) {
+    return -1;
+  }
+  char *candidate = table->names[index];
+  for (int i = 0; i < length; i++) {
+    if (candidate[i] != tolower((unsigned char)name[i])) {
+      return -1;
+    }
+  }
+  return candidate[length] == '\0' ? index : -1;
+}
+
+int tag_name_length(char *p) {
+  int length = 0;
+  while (isalnum((unsigned char)p[length]) || p[length] == '-') {
+    length++;
+  }
+  return length;
+}
+
+// Skips to just after the `>` closing the current tag, ignoring any `>`
+// inside quoted attribute values.
+void skip_tag(char **p) {
+  char quote = '\0';
+  while (**p) {
+    if (quote) {
+      if (**p == quote) {
+        quote = '\0';
+      }
+    } else if (**p == '"' || **p == '\'') {
+      quote = **p;
+    } else if (**p == '>') {
+      (*p)++;
+      return;
+    }
+    (*p)++;
+  }
+}
+
+// Returns the start of the `</name` closing the raw text element `tag`.
+char *find_end_tag(char *p, char *end, TagKind tag) {
+  for (; p < end; p++) {
+    p = scan_byte(p, end, '<');
+    if (p < end && p[1] == '/' &&
+        lookup_perfect_hash(&tag_hash, p + 2, tag_name_length(p + 2)) ==
+            (int)tag) {
+      return p;
+    }
+  }
+  return end;
+}
+
+bool startswith(char *p, char *q) { return strncmp(p, q, strlen(q)) == 0; }
+
+void stack_push(Document *document, TagKind tag) {
+  document->tag_stack[document->tag_count++] = tag;
+  if (document->tag_count >= MAX_TAGS) {
     error("Stack overflow\n");
   }
 }
 
-TagKind stack_pop() {
-  tag_count--;
-  if (tag_count < 0) {
+TagKind stack_pop(Document *document) {
+  document->tag_count--;
+  if (document->tag_count < 0) {
     error("Stack underflow\n");
   }
-  return tag_stack[tag_count];
+  return document->tag_stack[document->tag_count];
 }
 
 bool consume_space(char **p) {
@@ -70,27 +395,61 @@ bool consume_space(char **p) {
   return count > 0;
 }
 
-void parse_color(char color_string[7], SDL_Color *color) {
+// Reads a `#RRGGBB` color. Returns false for any other form.
+bool parse_color(char *value, int length, SDL_Color *color) {
+  if (length != 7 || value[0] != '#' ||
+      strspn(value + 1, "0123456789abcdefABCDEF") < 6) {
+    return false;
+  }
   char buffer[3];
   buffer[2] = '\0';
-  if (startswith(color_string, "#")) {
-    buffer[0] = color_string[1];
-    buffer[1] = color_string[2];
-    color->r = strtol(buffer, NULL, 16);
-    buffer[0] = color_string[3];
-    buffer[1] = color_string[4];
-    color->g = strtol(buffer, NULL, 16);
-    buffer[0] = color_string[5];
-    buffer[1] = color_string[6];
-    color->b = strtol(buffer, NULL, 16);
-  } else {
-    error("colorのパースに失敗しました: %s\n", color_string);
-  }
+  buffer[0] = value[1];
+  buffer[1] = value[2];
+  color->r = strtol(buffer, NULL, 16);
+  buffer[0] = value[3];
+  buffer[1] = value[4];
+  color->g = strtol(buffer, NULL, 16);
+  buffer[0] = value[5];
+  buffer[1] = value[6];
+  color->b = strtol(buffer, NULL, 16);
   // printf("color: (%d, %d, %d)\n", color->r, color->g, color->b);
+  return true;
 }
 
+// Returns the value of the declaration at `*css_style` up to `;` and
+// stores its length without trailing spaces in `length`, then moves past
+// the `;`. The value is left in place.
+char *consume_value(char **css_style, int *length) {
+  consume_space(css_style);
+  char *value = *css_style;
+  while (**css_style != ';' && **css_style != '\0') {
+    (*css_style)++;
+  }
+  *length = *css_style - value;
+  while (*length > 0 && isspace((unsigned char)value[*length - 1])) {
+    (*length)--;
+  }
+  if (**css_style) {
+    (*css_style)++;
+  }
+  return value;
+}
+
+// Whether the value is the whole keyword, optionally followed by a space or
+// `!important`. `bolder` or `inline-block` do not match `bold` or `inline`.
+bool value_is(char *value, int length, char *keyword) {
+  int keyword_length = strlen(keyword);
+  return length >= keyword_length &&
+         memcmp(value, keyword, keyword_length) == 0 &&
+         (length == keyword_length || value[keyword_length] == ' ' ||
+          value[keyword_length] == '!');
+}
+
+// Applies the declarations in `css_style` to `css_property`. Properties
+// and values it does not support are reported and skipped, since they
+// also come from page stylesheets.
 CssProperty *parse_css(char *css_style, CssProperty *css_property) {
-  char buffer[200];
+  int length;
   consume_space(&css_style);
   while (*css_style) {
     consume_space(&css_style);
@@ -99,606 +458,1056 @@ CssProperty *parse_css(char *css_style, CssProperty *css_property) {
     }
     if (startswith(css_style, "color:")) {
       css_style += 6;
-      consume_space(&css_style);
-      int i = 0;
-      while (*css_style != ';' && *css_style != '\0') {
-        buffer[i] = *css_style;
-        i++;
-        css_style++;
-      }
-      css_style++;
-      buffer[i] = '\0';
-      parse_color(buffer, &(css_property->color));
+      char *value = consume_value(&css_style, &length);
+      if (!parse_color(value, length, &(css_property->color))) {
+        warning("colorの値を無視しました: %.*s\n", length, value);
+      }
     } else if (startswith(css_style, "font-size:")) {
       css_style += 10;
-      consume_space(&css_style);
-      int i = 0;
-      while (*css_style != ';' && *css_style != '\0') {
-        buffer[i] = *css_style;
-        i++;
-        css_style++;
-      }
-      if (buffer[i - 1] != '%') {
-        buffer[i] = '\0';
-        error("font-sizeのパースに失敗しました: %s\n", buffer);
-      }
-      css_style++;
-      buffer[i] = '\0';
-      css_property->font_size = strtol(buffer, NULL, 10);
+      char *value = consume_value(&css_style, &length);
+      if (length > 1 && value[length - 1] == '%' &&
+          strspn(value, "0123456789") == (size_t)(length - 1)) {
+        css_property->font_size = strtol(value, NULL, 10);
+      } else {
+        warning("font-sizeの値を無視しました: %.*s\n", length, value);
+      }
     } else if (startswith(css_style, "font-weight:")) {
       css_style += 12;
-      consume_space(&css_style);
-      int i = 0;
-      while (*css_style != ';' && *css_style != '\0') {
-        buffer[i] = *css_style;
-        i++;
-        css_style++;
-      }
-      css_style++;
-      buffer[i] = '\0';
-      if (startswith(buffer, "normal")) {
+      char *value = consume_value(&css_style, &length);
+      if (value_is(value, length, "normal")) {
         css_property->font_weight = FONT_NORMAL;
-      } else if (startswith(buffer, "bold")) {
+      } else if (value_is(value, length, "bold")) {
         css_property->font_weight = FONT_BOLD;
       } else {
-        error("font-weightのパースに失敗しました: %s\n", buffer);
+        warning("font-weightの値を無視しました: %.*s\n", length, value);
       }
     } else if (startswith(css_style, "font-style:")) {
       css_style += 11;
-      consume_space(&css_style);
-      int i = 0;
-      while (*css_style != ';' && *css_style != '\0') {
-        buffer[i] = *css_style;
-        i++;
-        css_style++;
-      }
-      css_style++;
-      buffer[i] = '\0';
-      if (startswith(buffer, "normal")) {
+      char *value = consume_value(&css_style, &length);
+      if (value_is(value, length, "normal")) {
         css_property->font_style = FONT_NORMAL;
-      } else if (startswith(buffer, "italic")) {
+      } else if (value_is(value, length, "italic")) {
         css_property->font_style = FONT_ITALIC;
       } else {
-        error("font-styleのパースに失敗しました: %s\n", buffer);
+        warning("font-styleの値を無視しました: %.*s\n", length, value);
       }
     } else if (startswith(css_style, "text-decoration:")) {
-      css_style += 15;
-      consume_space(&css_style);
-      int i = 0;
-      while (*css_style != ';' && *css_style != '\0') {
-        buffer[i] = *css_style;
-        i++;
-        css_style++;
-      }
-      css_style++;
-      buffer[i] = '\0';
-      if (startswith(buffer, "none")) {
+      css_style += 16;
+      char *value = consume_value(&css_style, &length);
+      if (value_is(value, length, "none")) {
         css_property->text_decoration = TEXT_NONE;
-      } else if (startswith(buffer, "underline")) {
+      } else if (value_is(value, length, "underline")) {
         css_property->text_decoration = TEXT_UNDERLINE;
       } else {
-        error("text-decorationのパースに失敗しました: %s\n", buffer);
+        warning("text-decorationの値を無視しました: %.*s\n", length, value);
       }
     } else if (startswith(css_style, "display:")) {
       css_style += 8;
-      consume_space(&css_style);
-      int i = 0;
-      while (*css_style != ';' && *css_style != '\0') {
-        buffer[i] = *css_style;
-        i++;
-        css_style++;
-      }
-      css_style++;
-      buffer[i] = '\0';
-      if (startswith(buffer, "none")) {
+      char *value = consume_value(&css_style, &length);
+      if (value_is(value, length, "none")) {
         css_property->display = DISPLAY_NONE;
-      } else if (startswith(buffer, "block")) {
+      } else if (value_is(value, length, "block")) {
         css_property->display = DISPLAY_BLOCK;
-      } else if (startswith(buffer, "inline")) {
+      } else if (value_is(value, length, "inline")) {
         css_property->display = DISPLAY_INLINE;
       } else {
-        error("displayのパースに失敗しました: %s\n", buffer);
+        warning("displayの値を無視しました: %.*s\n", length, value);
       }
     } else {
-      int i = 0;
-      int j = 0;
-      bool space2 = false;
-      while (*(css_style + i) != ';' && *(css_style + i) != '\0') {
-        if (*(css_style + i) == ':') {
-          space2 = true;
-        } else if (!space2) {
-          buffer[j] = *(css_style + i);
-          j++;
-        }
-        i++;
+      char *name = css_style;
+      int name_length = strcspn(name, ":;");
+      consume_value(&css_style, &length);
+      if (name_length > 0) {
+        warning("CSSプロパティを無視しました: %.*s\n", name_length, name);
       }
-      buffer[j] = '\0';
-      css_style += (i + 1);
-      if (buffer[0] != '\0') {
-        warning("CSSプロパティを無視しました: %s\n", buffer);
+    }
+  }
+  return css_property;
+}
+
+// FNV-1a over `length` bytes, continuing from `hash`.
+uint32_t hash_bytes(uint32_t hash, const void *data, size_t length) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static uint32_t hash_style(CssProperty *style) {
+  uint32_t hash = 2166136261u;
+  hash = hash_bytes(hash, &style->color, sizeof(style->color));
+  hash = hash_bytes(hash, &style->font_size, sizeof(style->font_size));
+  hash = hash_bytes(hash, &style->font_weight, sizeof(style->font_weight));
+  hash = hash_bytes(hash, &style->font_style, sizeof(style->font_style));
+  hash = hash_bytes(hash, &style->text_decoration,
+                    sizeof(style->text_decoration));
+  return hash_bytes(hash, &style->display, sizeof(style->display));
+}
+
+static bool equal_style(CssProperty *a, CssProperty *b) {
+  return a->color.r == b->color.r && a->color.g == b->color.g &&
+         a->color.b == b->color.b && a->color.a == b->color.a &&
+         a->font_size == b->font_size && a->font_weight == b->font_weight &&
+         a->font_style == b->font_style &&
+         a->text_decoration == b->text_decoration &&
+         a->display == b->display;
+}
+
+static uint32_t hash_derivation(CssProperty *parent, const TagStyle *tag_style,
+                                char *declarations, int length) {
+  uint32_t hash = 2166136261u;
+  hash = hash_bytes(hash, &parent, sizeof(parent));
+  hash = hash_bytes(hash, &tag_style, sizeof(tag_style));
+  return hash_bytes(hash, declarations, length);
+}
+
+// Returns the shared copy of `style`, adding it to the table if needed.
+// Interned styles are shared between tokens and must not be modified.
+CssProperty *intern_style(Document *document, CssProperty *style) {
+  StyleTable *table = &document->styles;
+  if ((table->count + 1) * 2 > table->capacity) {
+    int capacity = table->capacity ? table->capacity * 2 : 64;
+    CssProperty **entries = calloc(capacity, sizeof(CssProperty *));
+    for (int i = 0; i < table->capacity; i++) {
+      if (table->entries[i] == NULL) {
+        continue;
+      }
+      uint32_t j = hash_style(table->entries[i]) & (capacity - 1);
+      while (entries[j] != NULL) {
+        j = (j + 1) & (capacity - 1);
+      }
+      entries[j] = table->entries[i];
+    }
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+  }
+
+  uint32_t i = hash_style(style) & (table->capacity - 1);
+  while (table->entries[i] != NULL) {
+    if (equal_style(table->entries[i], style)) {
+      return table->entries[i];
+    }
+    i = (i + 1) & (table->capacity - 1);
+  }
+  CssProperty *shared = arena_alloc(&document->arena, sizeof(CssProperty));
+  *shared = *style;
+  table->entries[i] = shared;
+  table->count++;
+  return shared;
+}
+
+// Resolves the style of an element with `tag_style` defaults and inline
+// `declarations` under `parent`. Each distinct combination is resolved once
+// and remembered, so repeated elements only cost a lookup.
+CssProperty *compute_style(Document *document, CssProperty *parent,
+                           const TagStyle *tag_style, char *declarations,
+                           int length) {
+  StyleTable *table = &document->styles;
+  if ((table->derivation_count + 1) * 2 > table->derivation_capacity) {
+    int capacity =
+        table->derivation_capacity ? table->derivation_capacity * 2 : 64;
+    StyleDerivation *derivations = calloc(capacity, sizeof(StyleDerivation));
+    for (int i = 0; i < table->derivation_capacity; i++) {
+      StyleDerivation *derivation = &table->derivations[i];
+      if (derivation->style == NULL) {
+        continue;
+      }
+      uint32_t j = hash_derivation(derivation->parent, derivation->tag_style,
+                                   derivation->declarations,
+                                   derivation->length) &
+                   (capacity - 1);
+      while (derivations[j].style != NULL) {
+        j = (j + 1) & (capacity - 1);
+      }
+      derivations[j] = *derivation;
+    }
+    free(table->derivations);
+    table->derivations = derivations;
+    table->derivation_capacity = capacity;
+  }
+
+  uint32_t i = hash_derivation(parent, tag_style, declarations, length) &
+               (table->derivation_capacity - 1);
+  while (table->derivations[i].style != NULL) {
+    StyleDerivation *derivation = &table->derivations[i];
+    if (derivation->parent == parent && derivation->tag_style == tag_style &&
+        derivation->length == length &&
+        memcmp(derivation->declarations, declarations, length) == 0) {
+      return derivation->style;
+    }
+    i = (i + 1) & (table->derivation_capacity - 1);
+  }
+
+  CssProperty style = parent ? *parent : initial_style;
+  style.display = tag_style->value.display;
+  if (tag_style->set & STYLE_COLOR) {
+    style.color = tag_style->value.color;
+  }
+  if (tag_style->set & STYLE_FONT_WEIGHT) {
+    style.font_weight = tag_style->value.font_weight;
+  }
+  if (tag_style->set & STYLE_FONT_STYLE) {
+    style.font_style = tag_style->value.font_style;
+  }
+  if (tag_style->set & STYLE_TEXT_DECORATION) {
+    style.text_decoration = tag_style->value.text_decoration;
+  }
+  if (length > 0) {
+    declarations = arena_strndup(&document->arena, declarations, length);
+    parse_css(declarations, &style);
+  }
+
+  StyleDerivation *derivation = &table->derivations[i];
+  derivation->parent = parent;
+  derivation->tag_style = tag_style;
+  derivation->declarations = declarations;
+  derivation->length = length;
+  derivation->style = intern_style(document, &style);
+  table->derivation_count++;
+  return derivation->style;
+}
+
+void free_style_table(StyleTable *table) {
+  free(table->entries);
+  free(table->derivations);
+  *table = (StyleTable){0};
+}
+
+bool is_name_char(char c) {
+  return isalnum((unsigned char)c) || c == '-' || c == '_';
+}
+
+// Bucket of the id (`kind` '#') or class (`kind` '.') `name`.
+StyleRule **rule_bucket(StyleSheet *sheet, char kind, char *name, int length) {
+  uint32_t hash = hash_bytes(2166136261u ^ (unsigned char)kind, name, length);
+  return &sheet->buckets[hash & (sheet->bucket_count - 1)];
+}
+
+void insert_rule(StyleSheet *sheet, StyleRule *rule) {
+  StyleRule **bucket;
+  if (rule->id != NULL) {
+    bucket = rule_bucket(sheet, '#', rule->id, strlen(rule->id));
+  } else if (rule->class_count > 0) {
+    char *name = rule->classes[0];
+    bucket = rule_bucket(sheet, '.', name, strlen(name));
+  } else if (rule->tag >= 0) {
+    bucket = &sheet->tag_rules[rule->tag];
+  } else {
+    bucket = &sheet->universal_rules;
+  }
+  rule->next = *bucket;
+  *bucket = rule;
+}
+
+// Adds a rule for one selector of a rule set. Selectors with combinators,
+// pseudo-classes or attributes are ignored.
+void add_style_rule(Document *document, char *selector, int length,
+                    char *declarations, int declarations_length) {
+  StyleSheet *sheet = &document->sheet;
+  StyleRule rule = {.tag = -1};
+  char *classes[16];
+  char *p = selector;
+  char *end = selector + length;
+  if (p < end && *p == '*') {
+    p++;
+  } else if (p < end && is_name_char(*p)) {
+    int name_length = tag_name_length(p);
+    rule.tag = lookup_perfect_hash(&tag_hash, p, name_length);
+    if (rule.tag < 0) {
+      // 対応していないタグの要素は作られないので、規則も要らない
+      return;
+    }
+    rule.specificity += 1;
+    p += name_length;
+  }
+  while (p < end && (*p == '#' || *p == '.')) {
+    char kind = *p++;
+    char *name = p;
+    while (p < end && is_name_char(*p)) {
+      p++;
+    }
+    if (p == name || (kind == '#' && rule.id != NULL) ||
+        (kind == '.' && rule.class_count == 16)) {
+      break;
+    }
+    if (kind == '#') {
+      rule.id = arena_strndup(&document->arena, name, p - name);
+      rule.specificity += 100;
+    } else {
+      classes[rule.class_count++] =
+          arena_strndup(&document->arena, name, p - name);
+      rule.specificity += 10;
+    }
+  }
+  if (p != end || p == selector) {
+    warning("セレクタを無視しました: %.*s\n", length, selector);
+    return;
+  }
+
+  if ((sheet->rule_count + 1) * 2 > sheet->bucket_count * 3) {
+    // バケットを倍にして、id と class の規則を入れ直す
+    int count = sheet->bucket_count ? sheet->bucket_count * 2 : 64;
+    StyleRule **old = sheet->buckets;
+    int old_count = sheet->bucket_count;
+    sheet->buckets = calloc(count, sizeof(StyleRule *));
+    if (sheet->buckets == NULL) {
+      error("メモリを確保できません\n");
+    }
+    sheet->bucket_count = count;
+    for (int i = 0; i < old_count; i++) {
+      while (old[i] != NULL) {
+        StyleRule *moved = old[i];
+        old[i] = moved->next;
+        insert_rule(sheet, moved);
       }
+    }
+    free(old);
+  }
+  StyleRule *shared = arena_alloc(&document->arena, sizeof(StyleRule));
+  *shared = rule;
+  shared->classes =
+      arena_alloc(&document->arena, rule.class_count * sizeof(char *));
+  memcpy(shared->classes, classes, rule.class_count * sizeof(char *));
+  shared->order = sheet->rule_count++;
+  shared->declarations = declarations;
+  shared->length = declarations_length;
+  insert_rule(sheet, shared);
+}
+
+char *skip_css_space(char *p, char *end) {
+  while (p < end && isspace((unsigned char)*p)) {
+    p++;
+  }
+  return p;
+}
+
+// Skips an at-rule such as @media or @import, including its block.
+char *skip_at_rule(char *p, char *end) {
+  int depth = 0;
+  for (; p < end; p++) {
+    if (*p == ';' && depth == 0) {
+      return p + 1;
+    } else if (*p == '{') {
+      depth++;
+    } else if (*p == '}' && --depth <= 0) {
+      return p + 1;
+    }
+  }
+  return end;
+}
+
+// Parses the contents of a <style> element into the document's style sheet.
+void parse_stylesheet(Document *document, char *source, int length) {
+  // コメントは空白に置き換えたコピーを作っておく
+  char *css = arena_strndup(&document->arena, source, length);
+  char *end = css + length;
+  for (char *p = css; (p = scan_string(p, end, "/*", 2)) < end;) {
+    char *close = scan_string(p + 2, end, "*/", 2);
+    close = close < end ? close + 2 : end;
+    memset(p, ' ', close - p);
+    p = close;
+  }
+
+  char *p = css;
+  for (;;) {
+    p = skip_css_space(p, end);
+    if (p >= end) {
+      break;
+    }
+    if (*p == '@') {
+      p = skip_at_rule(p, end);
       continue;
     }
+    char *selectors = p;
+    char *open = scan_byte(p, end, '{');
+    char *close = scan_byte(open, end, '}');
+    if (close >= end) {
+      break;
+    }
+    char *declarations = skip_css_space(open + 1, close);
+    int declarations_length = close - declarations;
+    for (char *q = selectors; q < open;) {
+      char *comma = scan_byte(q, open, ',');
+      char *first = skip_css_space(q, comma);
+      char *last = comma;
+      while (last > first && isspace((unsigned char)last[-1])) {
+        last--;
+      }
+      if (last > first) {
+        add_style_rule(document, first, last - first, declarations,
+                       declarations_length);
+      }
+      q = comma + 1;
+    }
+    p = close + 1;
   }
-  return css_property;
 }
 
-void consume_style(Token *cur, char **p) {
-  char buffer[200];
-  consume_space(p);
-  if (startswith(*p, "id=\"")) {
-    (*p) += 4;
-    int i = 0;
-    int n = 0;
-    while (*(*p + i) != '\"') {
-      buffer[n] = *(*p + i);
-      i++;
-      n++;
-    }
-    buffer[n] = '\0';
-    (*p) += (i + 1);
-    strcpy(cur->html_id, buffer);
-    warning("idは利用できません\n");
-  }
-  consume_space(p);
-  if (startswith(*p, "class=\"")) {
-    *p += 7;
-    int i = 0;
-    int n = 0;
-    while (*(*p + i) != '\"') {
-      buffer[n] = *(*p + i);
-      i++;
-      n++;
-    }
-    buffer[n] = '\0';
-    (*p) += (i + 1);
-    strcpy(cur->html_class, buffer);
-    warning("classは利用できません\n");
-  }
-  consume_space(p);
-  if (startswith(*p, "style=\"")) {
-    (*p) += 7;
-    int i = 0;
-    int n = 0;
-    while (*(*p + i) != '\"') {
-      buffer[n] = *(*p + i);
-      i++;
-      n++;
-    }
-    buffer[n] = '\0';
-    (*p) += (i + 1);
-    parse_css(buffer, cur->css_property);
-    // printf("styleを認識しました: %s\n", buffer);
-  }
-  consume_space(p);
-  while (**p != '>') {
+bool has_class(Token *token, char *name) {
+  int length = strlen(name);
+  for (char *p = token->html_class; *p;) {
+    while (isspace((unsigned char)*p)) {
+      p++;
+    }
+    char *word = p;
+    while (*p && !isspace((unsigned char)*p)) {
+      p++;
+    }
+    if (p - word == length && memcmp(word, name, length) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool match_rule(StyleRule *rule, Token *token) {
+  if ((rule->tag >= 0 && rule->tag != (int)token->tag) ||
+      (rule->id != NULL &&
+       (token->html_id == NULL || strcmp(rule->id, token->html_id) != 0))) {
+    return false;
+  }
+  for (int i = 0; i < rule->class_count; i++) {
+    if (token->html_class == NULL || !has_class(token, rule->classes[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void collect_rules(StyleSheet *sheet, StyleRule *rule, Token *token,
+                   int *count) {
+  for (; rule != NULL; rule = rule->next) {
+    if (!match_rule(rule, token)) {
+      continue;
+    }
+    if (*count == sheet->matched_capacity) {
+      sheet->matched_capacity =
+          sheet->matched_capacity ? sheet->matched_capacity * 2 : 32;
+      sheet->matched = realloc(sheet->matched,
+                               sheet->matched_capacity * sizeof(StyleRule *));
+      if (sheet->matched == NULL) {
+        error("メモリを確保できません\n");
+      }
+    }
+    sheet->matched[(*count)++] = rule;
+  }
+}
+
+// Finds the rules matching `token`, looking only in the buckets of its id,
+// its classes and its tag, and returns them in cascade order.
+int match_rules(StyleSheet *sheet, Token *token) {
+  int count = 0;
+  if (token->html_id != NULL && sheet->bucket_count > 0) {
+    char *id = token->html_id;
+    collect_rules(sheet, *rule_bucket(sheet, '#', id, strlen(id)), token,
+                  &count);
+  }
+  for (char *p = token->html_class; p != NULL && sheet->bucket_count > 0;) {
+    while (isspace((unsigned char)*p)) {
+      p++;
+    }
+    char *word = p;
+    while (*p && !isspace((unsigned char)*p)) {
+      p++;
+    }
+    if (p == word) {
+      break;
+    }
+    collect_rules(sheet, *rule_bucket(sheet, '.', word, p - word), token,
+                  &count);
+  }
+  collect_rules(sheet, sheet->tag_rules[token->tag], token, &count);
+  collect_rules(sheet, sheet->universal_rules, token, &count);
+
+  // 詳細度、同じなら出現順に並べる。同じ規則は1つにまとめる
+  for (int i = 1; i < count; i++) {
+    StyleRule *rule = sheet->matched[i];
+    int j = i;
+    while (j > 0 && (sheet->matched[j - 1]->specificity > rule->specificity ||
+                     (sheet->matched[j - 1]->specificity ==
+                          rule->specificity &&
+                      sheet->matched[j - 1]->order > rule->order))) {
+      sheet->matched[j] = sheet->matched[j - 1];
+      j--;
+    }
+    sheet->matched[j] = rule;
+  }
+  int unique = 0;
+  for (int i = 0; i < count; i++) {
+    if (unique == 0 || sheet->matched[unique - 1] != sheet->matched[i]) {
+      sheet->matched[unique++] = sheet->matched[i];
+    }
+  }
+  return unique;
+}
+
+void free_style_sheet(StyleSheet *sheet) {
+  free(sheet->buckets);
+  free(sheet->matched);
+  free(sheet->buffer);
+  *sheet = (StyleSheet){0};
+}
+
+// Returns the declarations of the style sheet rules matching `token`
+// followed by its inline `declarations`, so that later ones win. The result
+// is valid until the next call.
+char *cascade(Document *document, Token *token, char *declarations,
+              int *length) {
+  StyleSheet *sheet = &document->sheet;
+  int count = match_rules(sheet, token);
+  if (count == 0) {
+    return declarations;
+  }
+  int size = *length + 1;
+  for (int i = 0; i < count; i++) {
+    size += sheet->matched[i]->length + 1;
+  }
+  if (size > sheet->buffer_capacity) {
+    sheet->buffer_capacity = size * 2;
+    sheet->buffer = realloc(sheet->buffer, sheet->buffer_capacity);
+    if (sheet->buffer == NULL) {
+      error("メモリを確保できません\n");
+    }
+  }
+  int used = 0;
+  for (int i = 0; i < count; i++) {
+    memcpy(sheet->buffer + used, sheet->matched[i]->declarations,
+           sheet->matched[i]->length);
+    used += sheet->matched[i]->length;
+    sheet->buffer[used++] = ';';
+  }
+  if (*length > 0) {
+    memcpy(sheet->buffer + used, declarations, *length);
+    used += *length;
+  }
+  sheet->buffer[used] = '\0';
+  *length = used;
+  return sheet->buffer;
+}
+
+// Consumes the attributes of a start tag up to and including `>`, then
+// resolves the style of `cur`.
+void consume_style(Document *document, Token *cur, CssProperty *parent,
+                   char **p) {
+  char *declarations = NULL;
+  int declarations_length = 0;
+  for (;;) {
+    consume_space(p);
+    if (**p == '>' || **p == '\0') {
+      break;
+    }
+    if (**p == '/') {
+      (*p)++;
+      continue;
+    }
+    char *name = *p;
+    while (**p && !isspace((unsigned char)**p) && **p != '=' && **p != '>' &&
+           **p != '/') {
+      (*p)++;
+    }
+    int name_length = *p - name;
+    char *value = *p;
+    int length = 0;
+    consume_space(p);
+    if (**p == '=') {
+      (*p)++;
+      consume_space(p);
+      if (**p == '"' || **p == '\'') {
+        char quote = **p;
+        (*p)++;
+        value = *p;
+        while (**p && **p != quote) {
+          (*p)++;
+        }
+        length = *p - value;
+        if (**p) {
+          (*p)++;
+        }
+      } else {
+        value = *p;
+        while (**p && !isspace((unsigned char)**p) && **p != '>') {
+          (*p)++;
+        }
+        length = *p - value;
+      }
+    }
+    switch (lookup_perfect_hash(&attribute_hash, name, name_length)) {
+    case ATTR_ID:
+      cur->html_id = arena_strndup(&document->arena, value, length);
+      break;
+    case ATTR_CLASS:
+      cur->html_class = arena_strndup(&document->arena, value, length);
+      break;
+    case ATTR_STYLE:
+      declarations = value;
+      declarations_length = length;
+      // printf("styleを認識しました: %.*s\n", length, value);
+      break;
+    default:
+      break;
+    }
+  }
+  if (**p == '>') {
     (*p)++;
   }
-  (*p)++;
-}
-
-// Tokenize `user_input` and returns new tokens.
-Token *tokenize() {
-  char *p = user_input;
-  Token head;
-  head.next = NULL;
-  head.css_property = calloc(1, sizeof(CssProperty));
-  head.css_property->color = (SDL_Color){0, 0, 0};
-  head.css_property->font_size = 100;
-  head.css_property->font_weight = FONT_NORMAL;
-  head.css_property->font_style = FONT_NORMAL;
-  head.css_property->text_decoration = TEXT_NONE;
-  head.css_property->display = DISPLAY_BLOCK;
+  if (document->sheet.rule_count > 0) {
+    declarations = cascade(document, cur, declarations, &declarations_length);
+  }
+  cur->css_property = compute_style(document, parent, &tag_styles[cur->tag],
+                                    declarations, declarations_length);
+}
+
+// Builds the name lookup tables. Must run before the first tokenize(), and
+// before any tokenizer thread starts.
+void init_tokenizer() {
+  if (tag_hash.count == 0) {
+    build_perfect_hash(&tag_hash, tag_names, supported_count);
+    build_perfect_hash(&attribute_hash, attribute_names, attribute_count);
+    init_line_breaks();
+    init_entities();
+  }
+}
+
+// Makes the tokens up to `last` visible to other threads. When tokenizing
+// in the background, also wakes the UI thread with an `event_type` event
+// unless one is already pending.
+void publish_tokens(Document *document, Token *first, Token *last, bool done) {
+  if (document->token == NULL) {
+    document->token = first;
+  }
+  SDL_AtomicSetPtr((void **)&document->published, last);
+  if (done) {
+    SDL_AtomicSet(&document->done, 1);
+  }
+  if (document->event_type != 0 && SDL_AtomicCAS(&document->notified, 0, 1)) {
+    SDL_Event event = {0};
+    event.type = document->event_type;
+    SDL_PushEvent(&event);
+  }
+}
+
+// Whether [p, end) is already stored the way text tokens hold it: no
+// character references, and whitespace only as single spaces.
+bool is_normalized_text(char *p, char *end) {
+  if (scan_byte(p, end, '&') < end) {
+    return false;
+  }
+  while ((p = scan_space(p, end)) < end) {
+    if (*p != ' ' || (p + 1 < end && scan_is_space(p[1]))) {
+      return false;
+    }
+    p++;
+  }
+  return true;
+}
+
+// Tokenize `document->source` and returns new tokens. Tokens and styles
+// are allocated in `document->arena`. Text tokens point into the source
+// unless their text had to be rewritten.
+Token *tokenize(Document *document) {
+  char *p = document->source;
+  char *end = document->source + document->length;
+  Token head = {0};
+  head.css_property =
+      compute_style(document, NULL, &tag_styles[TAG_DIV], NULL, 0);
   Token *cur = &head;
   Token *parent = &head;
-  TagKind tag;
+  // 開いている要素の開始タグと、それぞれの最後の子ノード。0 番目は文書全体
+  Token *open_elements[MAX_TAGS + 1];
+  uint32_t last_child[MAX_TAGS + 1];
+  uint32_t root = NO_NODE;
+  document->node_count = 0;
+  head.node = push_node(document, NULL, NO_NODE, &root);
+  open_elements[0] = &head;
+  last_child[0] = NO_NODE;
+  int tag;
   CssProperty *css_property;
-  bool tag_selected;
   bool spaced;
+  int steps = 0;
+  int *breaks = NULL;
+  int break_capacity = 0;
+
+  init_tokenizer();
 
-  while (*p) {
+  while (p < end && *p) {
+    // 一定数ごとに出来上がったトークンを公開する
+    if (++steps >= PUBLISH_TOKENS && cur != &head) {
+      steps = 0;
+      publish_tokens(document, head.next, cur, false);
+      if (SDL_AtomicGet(&document->cancel)) {
+        break;
+      }
+    }
+
+    if (document->node_count == NODE_CHUNK * NODE_CHUNKS) {
+      warning("ノードが多すぎるので、ここで読み込みを止めます\n");
+      document->failed = true;
+      break;
+    }
+
+    char *run = p;
     spaced = consume_space(&p);
-    if (!*p) {
+    if (p >= end || !*p) {
       break;
     }
-    tag_selected = false;
 
-    if (startswith(p, "<!--")) {
-      p += 4;
-      while (!startswith(p, "-->")) {
-        p++;
+    // script などの中身は終了タグまで読み飛ばす
+    if (tag_flags[parent->tag] & TAG_RAW_TEXT) {
+      char *text = p;
+      p = find_end_tag(p, end, parent->tag);
+      if (parent->tag == TAG_STYLE) {
+        parse_stylesheet(document, text, p - text);
       }
-      p += 3;
-      continue;
-    } else if (startswith(p, "<!DOCTYPE")) {
-      p += 9;
-      while (!startswith(p, ">")) {
-        p++;
+      if (p >= end) {
+        break;
       }
-      p++;
-      continue;
     }
 
-    // 特殊文字
-    for (int c = 0; c < convert_count; c++) {
-      if (startswith(p, convert_names[c])) {
-        cur = new_token(PLAIN_TEXT, cur, parent);
-        strcpy(cur->text, convert_values[c]);
-        p += strlen(convert_names[c]);
-        continue;
-      }
+    if (startswith(p, "<!--")) {
+      p = scan_string(p + 4, end, "-->", 3);
+      p = p < end ? p + 3 : end;
+      continue;
+    } else if (startswith(p, "<!DOCTYPE")) {
+      p = scan_byte(p + 9, end, '>');
+      p = p < end ? p + 1 : end;
+      continue;
     }
 
     // 終了タグ
     if (startswith(p, "</")) {
       p += 2;
       consume_space(&p);
-      for (int c = 0; c < supported_count; c++) {
-        if (startswith(p, tag_names[c])) {
-          if (*(p + strlen(tag_names[c])) != '>') {
-            continue;
-          }
-          tag = c;
-          p += strlen(tag_names[c]);
-          tag_selected = true;
-          // printf("終了タグを登録しました: %s\n", tag_names[tag]);
-          break;
-        }
-      }
-      if (!tag_selected) {
-        char buffer[800];
-        int i = 0;
-        while (*(p + i) != '>') {
-          buffer[i] = *(p + i);
-          i++;
-        }
-        buffer[i] = '\0';
-        p += (i + 1);
-        warning("終了タグを無視しました: %s\n", buffer);
+      int length = tag_name_length(p);
+      tag = lookup_perfect_hash(&tag_hash, p, length);
+      if (tag < 0 || (tag_flags[tag] & TAG_VOID)) {
+        warning("終了タグを無視しました: %.*s\n", length, p);
+        skip_tag(&p);
         continue;
       }
-      while (*p != '>') {
-        p++;
+      // printf("終了タグを登録しました: %s\n", tag_names[tag]);
+      skip_tag(&p);
+      int depth = document->tag_count;
+      while (depth > 0 && document->tag_stack[depth - 1] != tag) {
+        depth--;
       }
-      p++;
-      if (stack_pop() != tag) {
-        error("開始タグと終了タグの対応が取れていません: %s\n", tag_names[tag]);
-      }
-      css_property = parent->css_property;
-      parent = parent->parent;
-      cur = new_token(END_TAG, cur, parent);
-      cur->tag = tag;
-      cur->css_property = css_property;
-      continue;
-    }
-
-    // 単独タグ
-    if (startswith(p, "<br")) {
-      cur = new_token(START_TAG_ONLY, cur, parent);
-      cur->tag = TAG_BR;
-      p += 3;
-      while (*p != '>') {
-        p++;
+      if (depth == 0) {
+        warning("開始タグの無い終了タグを無視しました: %s\n", tag_names[tag]);
+        continue;
       }
-      p++;
-      continue;
-    } else if (startswith(p, "<img")) {
-      warning("imgタグは無視されます\n");
-      cur = new_token(START_TAG_ONLY, cur, parent);
-      cur->tag = TAG_IMG;
-      p += 4;
-      while (*p != '>') {
-        p++;
+      // 対応する開始タグより内側で開いたままの要素も、ここで閉じる
+      while (document->tag_count >= depth) {
+        TagKind open_tag = stack_pop(document);
+        if (open_tag != tag) {
+          warning("閉じられていない要素を閉じました: %s\n",
+                  tag_names[open_tag]);
+        }
+        css_property = parent->css_property;
+        cur = new_token(document, END_TAG, cur);
+        cur->node = parent->node;
+        parent->end = cur;
+        parent = open_elements[document->tag_count];
+        cur->tag = open_tag;
+        cur->css_property = css_property;
       }
-      p++;
       continue;
     }
 
     // 開始タグ
     if (startswith(p, "<")) {
       p++;
-      for (int c = 0; c < supported_count; c++) {
-        if (startswith(p, tag_names[c])) {
-          if (!isspace(*(p + strlen(tag_names[c]))) &&
-              *(p + strlen(tag_names[c])) != '>') {
-            continue;
-          }
-          tag = c;
-          tag_selected = true;
-          break;
-        }
+      int length = tag_name_length(p);
+      tag = lookup_perfect_hash(&tag_hash, p, length);
+      if (tag < 0) {
+        warning("開始タグを無視しました: %.*s\n", length, p);
+        skip_tag(&p);
+        continue;
       }
-      if (!tag_selected) {
-        char buffer[800];
-        int i = 0;
-        int j = 0;
-        bool space2 = false;
-        while (*(p + i) != '>') {
-          if (isspace(*(p + i))) {
-            space2 = true;
-          } else if (!space2) {
-            buffer[j] = *(p + i);
-            j++;
-          }
-          i++;
+      p += length;
+
+      // 単独タグ
+      if (tag_flags[tag] & TAG_VOID) {
+        if (tag == TAG_IMG) {
+          warning("imgタグは無視されます\n");
         }
-        buffer[j] = '\0';
-        p += (i + 1);
-        warning("開始タグを無視しました: %s\n", buffer);
+        cur = new_token(document, START_TAG_ONLY, cur);
+        push_node(document, cur, parent->node,
+                  &last_child[document->tag_count]);
+        cur->tag = tag;
+        cur->css_property = head.css_property;
+        skip_tag(&p);
         continue;
-      } else if (startswith(p, "div")) {
-        p += 3;
-        consume_space(&p);
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_DIV;
-        stack_push(TAG_DIV);
-        cur->css_property->display = DISPLAY_BLOCK;
-        cur->css_property->color = cur->parent->css_property->color;
-        cur->css_property->font_size = cur->parent->css_property->font_size;
-        cur->css_property->font_weight = cur->parent->css_property->font_weight;
-        cur->css_property->font_style = cur->parent->css_property->font_style;
-        cur->css_property->text_decoration =
-            cur->parent->css_property->text_decoration;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "span")) {
-        p += 4;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_SPAN;
-        stack_push(TAG_SPAN);
-        cur->css_property->display = DISPLAY_INLINE;
-        cur->css_property->color = cur->parent->css_property->color;
-        cur->css_property->font_size = cur->parent->css_property->font_size;
-        cur->css_property->font_weight = cur->parent->css_property->font_weight;
-        cur->css_property->font_style = cur->parent->css_property->font_style;
-        cur->css_property->text_decoration =
-            cur->parent->css_property->text_decoration;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "h1")) {
-        p += 2;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_H1;
-        stack_push(TAG_H1);
-        cur->css_property->display = DISPLAY_BLOCK;
-        cur->css_property->font_weight = FONT_BOLD;
-        cur->css_property->color = cur->parent->css_property->color;
-        cur->css_property->font_size = cur->parent->css_property->font_size;
-        cur->css_property->font_style = cur->parent->css_property->font_style;
-        cur->css_property->text_decoration =
-            cur->parent->css_property->text_decoration;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "h2")) {
-        p += 2;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_H2;
-        stack_push(TAG_H2);
-        cur->css_property->display = DISPLAY_BLOCK;
-        cur->css_property->font_weight = FONT_BOLD;
-        cur->css_property->color = cur->parent->css_property->color;
-        cur->css_property->font_size = cur->parent->css_property->font_size;
-        cur->css_property->font_style = cur->parent->css_property->font_style;
-        cur->css_property->text_decoration =
-            cur->parent->css_property->text_decoration;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "h3")) {
-        p += 2;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_H3;
-        stack_push(TAG_H3);
-        cur->css_property->display = DISPLAY_BLOCK;
-        cur->css_property->font_weight = FONT_BOLD;
-        cur->css_property->color = cur->parent->css_property->color;
-        cur->css_property->font_size = cur->parent->css_property->font_size;
-        cur->css_property->font_style = cur->parent->css_property->font_style;
-        cur->css_property->text_decoration =
-            cur->parent->css_property->text_decoration;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "ul")) {
-        p += 2;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_UL;
-        stack_push(TAG_UL);
-        cur->css_property->display = DISPLAY_BLOCK;
-        cur->css_property->color = cur->parent->css_property->color;
-        cur->css_property->font_size = cur->parent->css_property->font_size;
-        cur->css_property->font_weight = cur->parent->css_property->font_weight;
-        cur->css_property->font_style = cur->parent->css_property->font_style;
-        cur->css_property->text_decoration =
-            cur->parent->css_property->text_decoration;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "li")) {
-        p += 2;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_LI;
-        stack_push(TAG_LI);
-        cur->css_property->display = DISPLAY_BLOCK;
-        cur->css_property->color = cur->parent->css_property->color;
-        cur->css_property->font_size = cur->parent->css_property->font_size;
-        cur->css_property->font_weight = cur->parent->css_property->font_weight;
-        cur->css_property->font_style = cur->parent->css_property->font_style;
-        cur->css_property->text_decoration =
-            cur->parent->css_property->text_decoration;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "em")) {
-        p += 2;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_EM;
-        stack_push(TAG_EM);
-        cur->css_property->display = DISPLAY_INLINE;
-        cur->css_property->font_style = FONT_ITALIC;
-        cur->css_property->color = cur->parent->css_property->color;
-        cur->css_property->font_size = cur->parent->css_property->font_size;
-        cur->css_property->font_weight = cur->parent->css_property->font_weight;
-        cur->css_property->text_decoration =
-            cur->parent->css_property->text_decoration;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "strong")) {
-        p += 6;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_STRONG;
-        stack_push(TAG_STRONG);
-        cur->css_property->display = DISPLAY_INLINE;
-        cur->css_property->font_weight = FONT_BOLD;
-        cur->css_property->color = cur->parent->css_property->color;
-        cur->css_property->font_size = cur->parent->css_property->font_size;
-        cur->css_property->font_style = cur->parent->css_property->font_style;
-        cur->css_property->text_decoration =
-            cur->parent->css_property->text_decoration;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "title")) {
-        p += 5;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_TITLE;
-        stack_push(TAG_TITLE);
-        cur->css_property->display = DISPLAY_NONE;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "section")) {
-        p += 7;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_SECTION;
-        stack_push(TAG_SECTION);
-        cur->css_property->display = DISPLAY_BLOCK;
-        cur->css_property->color = cur->parent->css_property->color;
-        cur->css_property->font_size = cur->parent->css_property->font_size;
-        cur->css_property->font_weight = cur->parent->css_property->font_weight;
-        cur->css_property->font_style = cur->parent->css_property->font_style;
-        cur->css_property->text_decoration =
-            cur->parent->css_property->text_decoration;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "script")) {
-        p += 6;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_SCRIPT;
-        stack_push(TAG_SCRIPT);
-        cur->css_property->display = DISPLAY_NONE;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "pre")) {
-        p += 3;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_PRE;
-        stack_push(TAG_PRE);
-        cur->css_property->display = DISPLAY_BLOCK;
-        cur->css_property->color = cur->parent->css_property->color;
-        cur->css_property->font_size = cur->parent->css_property->font_size;
-        cur->css_property->font_weight = cur->parent->css_property->font_weight;
-        cur->css_property->font_style = cur->parent->css_property->font_style;
-        cur->css_property->text_decoration =
-            cur->parent->css_property->text_decoration;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "p")) {
-        p += 1;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_P;
-        stack_push(TAG_P);
-        cur->css_property->display = DISPLAY_BLOCK;
-        cur->css_property->color = cur->parent->css_property->color;
-        cur->css_property->font_size = cur->parent->css_property->font_size;
-        cur->css_property->font_weight = cur->parent->css_property->font_weight;
-        cur->css_property->font_style = cur->parent->css_property->font_style;
-        cur->css_property->text_decoration =
-            cur->parent->css_property->text_decoration;
-        consume_style(cur, &p);
-        parent = cur;
-      } else if (startswith(p, "a")) {
-        p += 1;
-        cur = new_token(START_TAG, cur, parent);
-        cur->tag = TAG_A;
-        stack_push(TAG_A);
-        cur->css_property->display = DISPLAY_INLINE;
-        cur->css_property->color = (SDL_Color){0, 0, 255};
-        cur->css_property->text_decoration = TEXT_UNDERLINE;
-        cur->css_property->font_size = cur->parent->css_property->font_size;
-        cur->css_property->font_weight = cur->parent->css_property->font_weight;
-        cur->css_property->font_style = cur->parent->css_property->font_style;
-        consume_style(cur, &p);
-        parent = cur;
-      } else {
-        error("開始タグを認識できません: %s\n", p);
       }
+
+      if (document->tag_count + 1 >= MAX_TAGS) {
+        warning("要素の入れ子が深すぎるので、ここで読み込みを止めます\n");
+        document->failed = true;
+        break;
+      }
+      cur = new_token(document, START_TAG, cur);
+      push_node(document, cur, parent->node,
+                &last_child[document->tag_count]);
+      cur->tag = tag;
+      stack_push(document, tag);
+      open_elements[document->tag_count] = cur;
+      last_child[document->tag_count] = NO_NODE;
+      consume_style(document, cur, parent->css_property, &p);
+      parent = cur;
       // printf("開始タグを登録しました: %s\n", tag_names[cur->tag]);
       continue;
     }
 
-    // プレーンテキスト
-    if ((*p != '<') && (*p != '>')) {
-      if (parent->tag == TAG_SCRIPT) {
-        while (!startswith(p, "</script>")) {
-          p++;
-        }
-        continue;
-      }
-      char buffer[4000];
-      int i = 0;
-      int length = 0;
+    // プレーンテキスト。テキスト中の '>' は文字として扱う
+    char *text_end = scan_byte(p, end, '<');
+    char *text;
+    int length = 0;
+    if (!is_normalized_text(run, text_end) || parent->tag == TAG_TITLE) {
+      // 連続する空白を1つにまとめ、文字参照を展開しながら、次のタグの
+      // 手前までをコピーする。タイトルはウィンドウに渡すので '\0' で
+      // 終わらせる
+      text = arena_alloc(&document->arena,
+                         (text_end - p) + (text_end - p) / 5 + 2);
       if (spaced) {
-        buffer[length] = ' ';
+        text[length] = ' ';
         length++;
       }
-      while ((*(p + i) != '<') && (*(p + i) != '>')) {
-        int count = 0;
-        while (isspace(*(p + i))) {
-          i++;
-          count++;
-        }
-        if (count > 0) {
-          buffer[length] = ' ';
+      while (p < text_end) {
+        char *space = scan_space(p, text_end);
+        length += decode_references(text + length, p, space);
+        p = space;
+        if (p < text_end) {
+          text[length] = ' ';
           length++;
+          while (p < text_end && scan_is_space(*p)) {
+            p++;
+          }
         }
-        if ((*(p + i) == '<') || (*(p + i) == '>')) {
-          break;
-        }
-        buffer[length] = *(p + i);
-        length++;
-        i++;
-      }
-      buffer[length] = '\0';
-      cur = new_token(PLAIN_TEXT, cur, parent);
-      strcpy(cur->text, buffer);
-      p += i;
-      cur->css_property->display = DISPLAY_INLINE;
-      cur->css_property->color = cur->parent->css_property->color;
-      cur->css_property->font_size = cur->parent->css_property->font_size;
-      cur->css_property->font_weight = cur->parent->css_property->font_weight;
-      cur->css_property->font_style = cur->parent->css_property->font_style;
-      cur->css_property->text_decoration =
-          cur->parent->css_property->text_decoration;
-      continue;
+      }
+      text[length] = '\0';
     } else {
-      error("トークナイズできません: %s\n", *p);
+      // 書き換えの要らない run は文書をそのまま指す
+      text = run;
+      length = text_end - run;
+      p = text_end;
+    }
+    cur = new_token(document, PLAIN_TEXT, cur);
+    push_node(document, cur, parent->node, &last_child[document->tag_count]);
+    cur->text = text;
+    cur->length = length;
+    // 改行できる位置は run ごとに一度だけ求めて残しておく
+    if (length > break_capacity) {
+      break_capacity = length * 2;
+      breaks = realloc(breaks, break_capacity * sizeof(int));
+      if (breaks == NULL) {
+        error("メモリを確保できません\n");
+      }
     }
+    cur->break_count = find_line_breaks(text, length, breaks);
+    if (cur->break_count > 0) {
+      cur->breaks =
+          arena_alloc(&document->arena, cur->break_count * sizeof(int));
+      memcpy(cur->breaks, breaks, cur->break_count * sizeof(int));
+    }
+    if (parent->tag == TAG_TITLE && document->title == NULL) {
+      SDL_AtomicSetPtr((void **)&document->title, cur);
+    }
+    cur->css_property = compute_style(document, parent->css_property,
+                                      &text_style, NULL, 0);
   }
 
-  new_token(TK_EOF, cur, parent);
+  free(breaks);
+  cur = new_token(document, TK_EOF, cur);
+  cur->css_property = head.css_property;
+  publish_tokens(document, head.next, cur, true);
   return head.next;
 }
 
-Token *parse_html(char *file_name) {
-  FILE *fp;
-  int chr;
-  fp = fopen(file_name, "r");
+// Reads the whole file into a heap buffer that grows in READ_CHUNK steps.
+// For regular files the size is known up front and the buffer is allocated
+// once. The buffer is NUL-terminated and its length is stored in `length`.
+// Returns NULL with a warning when the file cannot be read.
+char *try_read_file(char *file_name, size_t *length) {
+  FILE *fp = fopen(file_name, "rb");
   if (fp == NULL) {
-    error("%s file not open!\n", file_name);
+    warning("%s file not open!\n", file_name);
+    return NULL;
+  }
+  size_t capacity = READ_CHUNK;
+  if (fseek(fp, 0, SEEK_END) == 0) {
+    long size = ftell(fp);
+    if (size > 0) {
+      capacity = (size_t)size + READ_CHUNK;
+    }
+  }
+  rewind(fp);
+
+  char *buffer = malloc(capacity);
+  if (buffer == NULL) {
+    error("メモリを確保できません: %s\n", file_name);
+  }
+  size_t size = 0;
+  for (;;) {
+    if (capacity - size < READ_CHUNK) {
+      capacity *= 2;
+      buffer = realloc(buffer, capacity);
+      if (buffer == NULL) {
+        error("メモリを確保できません: %s\n", file_name);
+      }
+    }
+    size_t n = fread(buffer + size, 1, capacity - size - 1, fp);
+    if (n == 0) {
+      break;
+    }
+    size += n;
   }
-  int i = 0;
-  while ((chr = fgetc(fp)) != EOF) {
-    user_input[i] = chr;
-    i++;
+  if (ferror(fp)) {
+    warning("%s file not read!\n", file_name);
+    fclose(fp);
+    free(buffer);
+    return NULL;
   }
-  user_input[i] = '\0';
   fclose(fp);
 
-  token = tokenize();
-  return token;
+  buffer[size] = '\0';
+  *length = size;
+  return buffer;
+}
+
+char *read_file(char *file_name, size_t *length) {
+  char *buffer = try_read_file(file_name, length);
+  if (buffer == NULL) {
+    error("%s file not read!\n", file_name);
+  }
+  return buffer;
+}
+
+// Creates an empty document for `length` bytes of `source`, which must be a
+// NUL-terminated heap buffer. The document takes ownership of it.
+Document *new_document(char *source, size_t length) {
+  Document *document = calloc(1, sizeof(Document));
+  if (document == NULL) {
+    error("メモリを確保できません\n");
+  }
+  document->source = source;
+  document->length = length;
+  return document;
+}
+
+Document *parse_document(char *source, size_t length) {
+  Document *document = new_document(source, length);
+  document->token = tokenize(document);
+  return document;
+}
+
+Document *parse_html(char *file_name) {
+  size_t length;
+  char *source = read_file(file_name, &length);
+  return parse_document(source, length);
+}
+
+int tokenize_thread(void *data) {
+  tokenize(data);
+  return 0;
+}
+
+// Tokenizes the document on a worker thread. Each batch of new tokens is
+// announced with an `event_type` event; read them with published_tokens().
+void start_tokenizer(Document *document, Uint32 event_type) {
+  init_tokenizer();
+  document->event_type = event_type;
+  document->thread = SDL_CreateThread(tokenize_thread, "tokenizer", document);
+  if (document->thread == NULL) {
+    warning("SDL_CreateThread Error: %s\n", SDL_GetError());
+    tokenize(document);
+  }
+}
+
+// Returns the last token published so far, or NULL before the first batch.
+// Tokens from `document->token` up to it may be read while the tokenizer
+// keeps running. `done` tells whether it was the TK_EOF token.
+Token *published_tokens(Document *document, bool *done) {
+  SDL_AtomicSet(&document->notified, 0);
+  *done = SDL_AtomicGet(&document->done) != 0;
+  return SDL_AtomicGetPtr((void **)&document->published);
+}
+
+bool equal_token(Token *a, Token *b) {
+  if (a->kind != b->kind || a->tag != b->tag || a->length != b->length ||
+      !equal_style(a->css_property, b->css_property)) {
+    return false;
+  }
+  if ((a->text == NULL) != (b->text == NULL) ||
+      (a->text != NULL && memcmp(a->text, b->text, a->length) != 0)) {
+    return false;
+  }
+  if ((a->html_id == NULL) != (b->html_id == NULL) ||
+      (a->html_id != NULL && strcmp(a->html_id, b->html_id) != 0)) {
+    return false;
+  }
+  return (a->html_class == NULL) == (b->html_class == NULL) &&
+         (a->html_class == NULL || strcmp(a->html_class, b->html_class) == 0);
+}
+
+Token **token_array(Token *token, int *count) {
+  int capacity = 1024;
+  Token **tokens = malloc(capacity * sizeof(Token *));
+  int n = 0;
+  for (; token != NULL && token->kind != TK_EOF; token = token->next) {
+    if (n == capacity) {
+      capacity *= 2;
+      tokens = realloc(tokens, capacity * sizeof(Token *));
+    }
+    if (tokens == NULL) {
+      error("メモリを確保できません\n");
+    }
+    tokens[n++] = token;
+  }
+  *count = n;
+  return tokens;
+}
+
+// Compares two fully tokenized versions of a document and finds how many
+// tokens at the start and at the end are unchanged.
+void diff_tokens(Token *old_token, Token *new_token, TokenDiff *diff) {
+  Token **old_tokens = token_array(old_token, &diff->old_count);
+  Token **new_tokens = token_array(new_token, &diff->new_count);
+  int shorter = diff->old_count < diff->new_count ? diff->old_count
+                                                   : diff->new_count;
+  int prefix = 0;
+  while (prefix < shorter &&
+         equal_token(old_tokens[prefix], new_tokens[prefix])) {
+    prefix++;
+  }
+  // 末尾の一致は先頭の一致と重ならない範囲で数える
+  int suffix = 0;
+  while (suffix < shorter - prefix &&
+         equal_token(old_tokens[diff->old_count - 1 - suffix],
+                     new_tokens[diff->new_count - 1 - suffix])) {
+    suffix++;
+  }
+  diff->prefix = prefix;
+  diff->suffix = suffix;
+  free(old_tokens);
+  free(new_tokens);
+}
+
+// Returns the text of the first <title> tokenized so far, or NULL.
+char *document_title(Document *document) {
+  Token *title = SDL_AtomicGetPtr((void **)&document->title);
+  return title != NULL ? title->text : NULL;
+}
+
+// Frees the document together with every token, style and text in it.
+// A running tokenizer thread is stopped first.
+void free_document(Document *document) {
+  if (document->thread != NULL) {
+    SDL_AtomicSet(&document->cancel, 1);
+    SDL_WaitThread(document->thread, NULL);
+  }
+  arena_free(&document->arena);
+  free_style_sheet(&document->sheet);
+  free_style_table(&document->styles);
+  free(document->source);
+  free(document);
 }
@@ -2,6 +2,7 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,17 +13,28 @@
 #define BROWSER_PARSER_H
 
 #define MAX_TAGS 2000
+#define READ_CHUNK (64 * 1024)
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 8
+#define PUBLISH_TOKENS 1024
+#define NO_NODE UINT32_MAX
+#define NODE_CHUNK 4096
+#define NODE_CHUNKS 1024
 
 static char *tag_names[] = {
     "div", "span", "strong", "img", "title", "section", "pre", "script", "p",
-    "a",   "h1",   "h2",     "h3",  "ul",    "li",      "em",  "br"};
+    "a", "h1", "h2", "h3", "ul", "li", "em", "br", "html", "head", "body",
+    "header", "footer", "nav", "main", "article", "aside", "h4", "h5", "h6",
+    "ol", "blockquote", "figure", "figcaption", "address", "details", "summary",
+    "form", "noscript", "template", "style", "b", "i", "u", "s", "code",
+    "small", "mark", "sub", "sup", "abbr", "cite", "time", "kbd", "samp", "var",
+    "q", "dfn", "del", "ins", "label", "button", "hr", "meta", "link", "input",
+    "wbr", "base", "source", "track", "area", "col", "embed", "param"};
 static const int supported_count = sizeof(tag_names) / sizeof(tag_names[0]);
 
-static char *convert_names[] = {"&copy;", "&lt;",   "&gt;",
-                                "&amp;",  "&quot;", "&apos;"};
-static char *convert_values[] = {"©", "<", ">", "&", "\"", "'"};
-static const int convert_count =
-    sizeof(convert_names) / sizeof(convert_names[0]);
+static char *attribute_names[] = {"id", "class", "style"};
+static const int attribute_count =
+    sizeof(attribute_names) / sizeof(attribute_names[0]);
 
 typedef enum {
   START_TAG,
@@ -49,9 +61,81 @@ typedef enum {
   TAG_UL,
   TAG_LI,
   TAG_EM,
-  TAG_BR
+  TAG_BR,
+  TAG_HTML,
+  TAG_HEAD,
+  TAG_BODY,
+  TAG_HEADER,
+  TAG_FOOTER,
+  TAG_NAV,
+  TAG_MAIN,
+  TAG_ARTICLE,
+  TAG_ASIDE,
+  TAG_H4,
+  TAG_H5,
+  TAG_H6,
+  TAG_OL,
+  TAG_BLOCKQUOTE,
+  TAG_FIGURE,
+  TAG_FIGCAPTION,
+  TAG_ADDRESS,
+  TAG_DETAILS,
+  TAG_SUMMARY,
+  TAG_FORM,
+  TAG_NOSCRIPT,
+  TAG_TEMPLATE,
+  TAG_STYLE,
+  TAG_B,
+  TAG_I,
+  TAG_U,
+  TAG_S,
+  TAG_CODE,
+  TAG_SMALL,
+  TAG_MARK,
+  TAG_SUB,
+  TAG_SUP,
+  TAG_ABBR,
+  TAG_CITE,
+  TAG_TIME,
+  TAG_KBD,
+  TAG_SAMP,
+  TAG_VAR,
+  TAG_Q,
+  TAG_DFN,
+  TAG_DEL,
+  TAG_INS,
+  TAG_LABEL,
+  TAG_BUTTON,
+  TAG_HR,
+  TAG_META,
+  TAG_LINK,
+  TAG_INPUT,
+  TAG_WBR,
+  TAG_BASE,
+  TAG_SOURCE,
+  TAG_TRACK,
+  TAG_AREA,
+  TAG_COL,
+  TAG_EMBED,
+  TAG_PARAM
 } TagKind;
 
+typedef enum { ATTR_ID, ATTR_CLASS, ATTR_STYLE } AttributeKind;
+
+#define TAG_VOID (1 << 0)
+#define TAG_RAW_TEXT (1 << 1)
+
+#define PERFECT_HASH_SIZE 4096
+
+// Collision-free hash over a fixed list of names, built at startup by
+// searching for a seed under which no two names share a slot.
+typedef struct {
+  char **names;
+  int count;
+  uint32_t seed;
+  uint8_t slots[PERFECT_HASH_SIZE];
+} PerfectHash;
+
 typedef enum { FONT_NORMAL, FONT_BOLD, FONT_ITALIC } FontKind;
 typedef enum { TEXT_NONE, TEXT_UNDERLINE } TextDecoration;
 typedef enum { DISPLAY_NONE, DISPLAY_BLOCK, DISPLAY_INLINE } Display;
@@ -67,23 +151,210 @@ struct CssProperty {
   Display display;
 };
 
+#define STYLE_COLOR (1 << 0)
+#define STYLE_FONT_WEIGHT (1 << 1)
+#define STYLE_FONT_STYLE (1 << 2)
+#define STYLE_TEXT_DECORATION (1 << 3)
+
+// Default style of a tag. Properties not in `set` are inherited; `display`
+// always comes from `value`.
+typedef struct {
+  unsigned set;
+  CssProperty value;
+} TagStyle;
+
+typedef struct {
+  CssProperty *parent;
+  const TagStyle *tag_style;
+  char *declarations;
+  int length;
+  CssProperty *style;
+} StyleDerivation;
+
+// Interned computed styles of a document. Tokens with equal styles share one
+// CssProperty, so styles can be compared by pointer.
+typedef struct {
+  CssProperty **entries;
+  int capacity;
+  int count;
+  StyleDerivation *derivations;
+  int derivation_capacity;
+  int derivation_count;
+} StyleTable;
+
 typedef struct Token Token;
 
+// `index` is the position of the token in the document. `end` links a
+// start tag to its end tag, or is NULL while the element is still open;
+// read it only once tokenizing is done. `text` holds `length` bytes and
+// usually points into the document source, so it is not NUL-terminated.
 struct Token {
   TokenKind kind;
-  Token *next;
-  Token *parent;
   TagKind tag;
+  Token *next;
+  Token *end;
+  uint32_t index;
+  uint32_t node;
   CssProperty *css_property;
-  char text[4000];
-  char html_id[200];
-  char html_class[200];
+  char *text;
+  int length;
+  int *breaks;
+  int break_count;
+  char *html_id;
+  char *html_class;
+};
+
+// An element or text node of the document tree. `token` is the start tag
+// or text token of the node; links are indices for node_at(), with NO_NODE
+// for none. Node 0 is the root and has no token. Tokens store the index of
+// their node, end tags that of the element they close.
+typedef struct {
+  Token *token;
+  uint32_t parent;
+  uint32_t first_child;
+  uint32_t next_sibling;
+} Node;
+
+// A rule from a <style> element. Selectors are compound: a tag name or
+// `*`, then an optional `#id` and any number of `.class` parts.
+// Declarations point into the document's copy of the style sheet.
+typedef struct StyleRule StyleRule;
+
+struct StyleRule {
+  int tag;
+  char *id;
+  char **classes;
+  int class_count;
+  int specificity;
+  int order;
+  char *declarations;
+  int length;
+  StyleRule *next;
 };
 
+// Rules of a document's style sheets, bucketed by the most specific part of
+// their selector: id and class rules are hashed by name, the rest are kept
+// per tag or as universal rules. An element is only matched against the
+// buckets of its id, its classes and its tag.
+typedef struct {
+  StyleRule **buckets;
+  int bucket_count;
+  StyleRule *tag_rules[sizeof(tag_names) / sizeof(tag_names[0])];
+  StyleRule *universal_rules;
+  int rule_count;
+  StyleRule **matched;
+  int matched_capacity;
+  char *buffer;
+  int buffer_capacity;
+} StyleSheet;
+
+typedef struct ArenaBlock ArenaBlock;
+
+struct ArenaBlock {
+  ArenaBlock *next;
+  size_t used;
+  size_t capacity;
+  char data[];
+};
+
+// Bump allocator owning everything a document allocates.
+typedef struct {
+  ArenaBlock *head;
+  size_t block_count;
+  size_t reserved;
+  size_t used;
+} Arena;
+
+// A document and the state of its tokenizer. When tokenized in the
+// background, `token` becomes valid once `published` is set, and tokens up
+// to `published` never change again. `published` is read and written with
+// SDL_AtomicGetPtr/SDL_AtomicSetPtr, as is `title`, the text of the first
+// <title> element. `failed` is set when tokenizing stopped before the end
+// of the source; read it once `done` is set. Nodes are allocated
+// NODE_CHUNK at a time and never move. The token and parent of a node are
+// fixed once its token is published, but like Token.end, child and sibling
+// links may only be followed once `done` is set.
+typedef struct {
+  char *source;
+  size_t length;
+  Arena arena;
+  StyleTable styles;
+  StyleSheet sheet;
+  Token *token;
+  uint32_t token_count;
+  Token *title;
+  Node *node_chunks[NODE_CHUNKS];
+  uint32_t node_count;
+  TagKind tag_stack[MAX_TAGS];
+  int tag_count;
+  bool failed;
+  SDL_Thread *thread;
+  Uint32 event_type;
+  Token *published;
+  SDL_atomic_t done;
+  SDL_atomic_t cancel;
+  SDL_atomic_t notified;
+} Document;
+
+// Result of diff_tokens(). The first `prefix` and the last `suffix` tokens
+// of both versions are equal; TK_EOF is not counted.
+typedef struct {
+  int prefix;
+  int suffix;
+  int old_count;
+  int new_count;
+} TokenDiff;
+
 void error(char *fmt, ...);
 
 void warning(char *fmt, ...);
 
-Token *parse_html(char *file_name);
+void *arena_alloc(Arena *arena, size_t size);
+
+char *arena_strndup(Arena *arena, char *str, size_t length);
+
+void arena_free(Arena *arena);
+
+void build_perfect_hash(PerfectHash *table, char **names, int count);
+
+int lookup_perfect_hash(PerfectHash *table, char *name, int length);
+
+uint32_t hash_bytes(uint32_t hash, const void *data, size_t length);
+
+CssProperty *parse_css(char *css_style, CssProperty *css_property);
+
+CssProperty *intern_style(Document *document, CssProperty *style);
+
+CssProperty *compute_style(Document *document, CssProperty *parent,
+                           const TagStyle *tag_style, char *declarations,
+                           int length);
+
+char *try_read_file(char *file_name, size_t *length);
+
+char *read_file(char *file_name, size_t *length);
+
+void init_tokenizer();
+
+Token *tokenize(Document *document);
+
+Node *node_at(Document *document, uint32_t index);
+
+uint32_t find_node(Document *document, uint32_t from, uint32_t token_index);
+
+Document *new_document(char *source, size_t length);
+
+Document *parse_document(char *source, size_t length);
+
+Document *parse_html(char *file_name);
+
+void start_tokenizer(Document *document, Uint32 event_type);
+
+Token *published_tokens(Document *document, bool *done);
+
+char *document_title(Document *document);
+
+void diff_tokens(Token *old_token, Token *new_token, TokenDiff *diff);
+
+void free_document(Document *document);
 
 #endif
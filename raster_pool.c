@@ -0,0 +1,181 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "atlas.h"
+#include "fonts.h"
+#include "layout.h"
+#include "parser.h"
+#include "raster_pool.h"
+
+RasterJob *raster_jobs;
+int raster_job_count;
+int raster_job_capacity;
+
+#ifdef USE_GLYPH_ATLAS
+
+RasterWorker raster_workers[MAX_RASTER_WORKERS];
+int raster_worker_count;
+SDL_atomic_t raster_next;
+SDL_atomic_t raster_quit;
+SDL_sem *raster_done;
+
+// Rasterizes `job` with `font`, which must be used by this thread only.
+void rasterize_job(TTF_Font *font, RasterJob *job) {
+  int minx, maxx, miny, maxy, advance;
+  TTF_SetFontStyle(font, job->style);
+  if (TTF_GlyphMetrics32(font, job->codepoint, &minx, &maxx, &miny, &maxy,
+                         &advance) != 0) {
+    minx = 0;
+    advance = 0;
+  }
+  job->minx = minx;
+  job->advance = advance;
+  job->surface = NULL;
+
+  SDL_Color white = {255, 255, 255, 255};
+  SDL_Surface *surface = TTF_RenderGlyph32_Blended(font, job->codepoint, white);
+  if (surface != NULL) {
+    job->surface =
+        SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(surface);
+  }
+}
+
+// Takes jobs until none are left. `fonts` are the faces of the calling
+// thread and already hold every size the jobs need.
+void take_raster_jobs(FontCache *fonts) {
+  for (;;) {
+    int i = SDL_AtomicAdd(&raster_next, 1);
+    if (i >= raster_job_count) {
+      return;
+    }
+    RasterJob *job = &raster_jobs[i];
+    rasterize_job(cached_font(fonts, job->size, job->style), job);
+  }
+}
+
+int raster_worker_main(void *data) {
+  RasterWorker *worker = data;
+  for (;;) {
+    SDL_SemWait(worker->start);
+    if (SDL_AtomicGet(&raster_quit)) {
+      return 0;
+    }
+    take_raster_jobs(&worker->fonts);
+    SDL_SemPost(raster_done);
+  }
+}
+
+// Starts one worker per spare core. SDL_ttf fonts are not thread-safe, so
+// every worker has its own faces. They are opened by the main thread before
+// each batch, because FreeType does not allow opening faces concurrently.
+// Call after open_fonts().
+void start_raster_pool() {
+  int count = SDL_GetCPUCount() - 1;
+  if (count > MAX_RASTER_WORKERS) {
+    count = MAX_RASTER_WORKERS;
+  }
+  raster_done = SDL_CreateSemaphore(0);
+  if (raster_done == NULL) {
+    warning("SDL_CreateSemaphore Error: %s\n", SDL_GetError());
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    RasterWorker *worker = &raster_workers[raster_worker_count];
+    worker->start = SDL_CreateSemaphore(0);
+    worker->thread =
+        worker->start ? SDL_CreateThread(raster_worker_main, "raster", worker)
+                      : NULL;
+    if (worker->thread == NULL) {
+      warning("SDL_CreateThread Error: %s\n", SDL_GetError());
+      if (worker->start) {
+        SDL_DestroySemaphore(worker->start);
+      }
+      break;
+    }
+    raster_worker_count++;
+  }
+}
+
+void stop_raster_pool() {
+  SDL_AtomicSet(&raster_quit, 1);
+  for (int i = 0; i < raster_worker_count; i++) {
+    SDL_SemPost(raster_workers[i].start);
+  }
+  for (int i = 0; i < raster_worker_count; i++) {
+    RasterWorker *worker = &raster_workers[i];
+    SDL_WaitThread(worker->thread, NULL);
+    SDL_DestroySemaphore(worker->start);
+    free_font_cache(&worker->fonts);
+  }
+  raster_worker_count = 0;
+  SDL_AtomicSet(&raster_quit, 0);
+  if (raster_done) {
+    SDL_DestroySemaphore(raster_done);
+    raster_done = NULL;
+  }
+  free(raster_jobs);
+  raster_jobs = NULL;
+  raster_job_count = 0;
+  raster_job_capacity = 0;
+}
+
+RasterJob *add_raster_job() {
+  if (raster_job_count == raster_job_capacity) {
+    raster_job_capacity = raster_job_capacity ? raster_job_capacity * 2 : 256;
+    raster_jobs = realloc(raster_jobs, raster_job_capacity * sizeof(RasterJob));
+    if (raster_jobs == NULL) {
+      error("メモリを確保できません\n");
+    }
+  }
+  RasterJob *job = &raster_jobs[raster_job_count++];
+  memset(job, 0, sizeof(RasterJob));
+  return job;
+}
+
+// Rasterizes every queued job, spreading them over the workers and the
+// calling thread, and returns once all of them are done.
+void run_raster_jobs() {
+  if (raster_job_count == 0) {
+    return;
+  }
+  SDL_AtomicSet(&raster_next, 0);
+  // 少ない仕事はスレッドを起こすより自分でやるほうが速い
+  int workers = raster_job_count < 8 ? 0 : raster_worker_count;
+  // 使う大きさのフォントを先にこのスレッドで開いておく
+  for (int i = 0; i < workers; i++) {
+    tick_font_cache(&raster_workers[i].fonts);
+  }
+  for (int j = 0; j < raster_job_count; j++) {
+    RasterJob *job = &raster_jobs[j];
+    if (j > 0 && job->size == job[-1].size && job->style == job[-1].style) {
+      continue;
+    }
+    cached_font(&main_fonts, job->size, job->style);
+    for (int i = 0; i < workers; i++) {
+      cached_font(&raster_workers[i].fonts, job->size, job->style);
+    }
+  }
+  for (int i = 0; i < workers; i++) {
+    SDL_SemPost(raster_workers[i].start);
+  }
+  take_raster_jobs(&main_fonts);
+  for (int i = 0; i < workers; i++) {
+    SDL_SemWait(raster_done);
+  }
+}
+
+#else
+
+void start_raster_pool() {}
+
+void stop_raster_pool() {}
+
+#endif
@@ -0,0 +1,46 @@
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "fonts.h"
+
+#ifndef BROWSER_RASTER_POOL_H
+#define BROWSER_RASTER_POOL_H
+
+#define MAX_RASTER_WORKERS 8
+
+// A glyph to rasterize at `size` pixels. Each thread renders with its own
+// face of that size. The result is a white ARGB8888 surface (NULL for
+// blank glyphs) plus the glyph metrics.
+typedef struct {
+  int size;
+  int style;
+  Uint32 codepoint;
+  void *owner;
+  SDL_Surface *surface;
+  int minx;
+  int advance;
+} RasterJob;
+
+// Threads that own private faces of the page font.
+typedef struct {
+  SDL_Thread *thread;
+  SDL_sem *start;
+  FontCache fonts;
+} RasterWorker;
+
+extern RasterJob *raster_jobs;
+extern int raster_job_count;
+
+void rasterize_job(TTF_Font *font, RasterJob *job);
+
+void start_raster_pool();
+
+void stop_raster_pool();
+
+RasterJob *add_raster_job();
+
+void run_raster_jobs();
+
+#endif
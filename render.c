@@ -0,0 +1,357 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "atlas.h"
+#include "fonts.h"
+#include "layout.h"
+#include "parser.h"
+#include "render.h"
+#include "texture_cache.h"
+
+SDL_Window *window;
+SDL_Renderer *renderer;
+
+int window_height = 480;
+int window_width = 720;
+
+int scroll_width = 0;
+int scroll_height = 0;
+
+int scroll_offset_x = 0;
+int scroll_offset_y = 0;
+
+void quit_sdl() {
+  SDL_DestroyWindow(window);
+  SDL_DestroyRenderer(renderer);
+  SDL_DestroyWindow(window);
+  TTF_Quit();
+  SDL_Quit();
+}
+
+Tile *tiles;
+int tile_count;
+unsigned tile_generation;
+unsigned render_frame;
+
+// 直近のスクロールの向き (-1, 0, 1) と、先読みする距離 (ピクセル)
+int prefetch_direction_x;
+int prefetch_direction_y;
+int prefetch_distance;
+
+void paint_text(DisplayItem *item, SDL_Rect *dstrect, int clip_right) {
+#ifdef USE_GLYPH_ATLAS
+  queue_text(item->font_size, item->font_style, item->text, item->length,
+             dstrect->x, dstrect->y, item->color, clip_right);
+#else
+  // アトラスが使えない環境では文字列ごとのテクスチャをキャッシュから引く
+  SDL_Texture *texture =
+      find_text_texture(item->font_size, item->font_style, item->color,
+                        item->text, item->length, &dstrect->w, &dstrect->h);
+  if (texture != NULL) {
+    SDL_RenderCopy(renderer, texture, NULL, dstrect);
+  }
+#endif
+}
+
+// Paints the items that intersect the page rectangle `area` so that its
+// top-left corner lands at the origin of the current render target. Lines
+// are found through the line index, so the cost depends on the size of the
+// area rather than on the page length. Text is batched per atlas page and
+// drawn before the decorations that sit on it. Glyphs missing from the
+// atlases are rasterized in parallel before anything is queued.
+void paint_area(DisplayList *list, SDL_Rect *area) {
+  int right = area->x + area->w;
+  int bottom = area->y + area->h;
+  int first = find_first_line(list, area->y);
+  int last = first;
+  while (last < list->line_count && list->lines[last].top < bottom) {
+    last++;
+  }
+
+  for (int pass = 0; pass < 3; pass++) {
+    for (int l = first; l < last; l++) {
+      LineBox *line = &list->lines[l];
+      if (line->bottom <= area->y) {
+        continue;
+      }
+      for (int i = line->first; i < line->first + line->count; i++) {
+        DisplayItem *item = &list->items[i];
+        if (item->width <= 0 || item->x + item->width <= area->x ||
+            item->x >= right) {
+          continue;
+        }
+        SDL_Rect dstrect = {item->x - area->x, item->y - area->y,
+                            item->width, item->height};
+        if (pass == 0 && item->kind != ITEM_DECORATION) {
+          request_glyphs(item->font_size, item->font_style, item->text,
+                         item->length, dstrect.x, area->w);
+        } else if (pass == 1 && item->kind != ITEM_DECORATION) {
+          paint_text(item, &dstrect, area->w);
+        } else if (pass == 2 && item->kind == ITEM_DECORATION) {
+          SDL_SetRenderDrawColor(renderer, item->color.r, item->color.g,
+                                 item->color.b, 255);
+          SDL_RenderFillRect(renderer, &dstrect);
+        }
+      }
+    }
+    if (pass == 0) {
+      rasterize_requested_glyphs();
+    } else if (pass == 1) {
+      flush_text();
+    }
+  }
+}
+
+// Marks every tile as empty. The textures stay allocated and are reused for
+// the next tiles that are needed.
+void invalidate_tiles() {
+  for (int i = 0; i < tile_count; i++) {
+    tiles[i].column = -1;
+    tiles[i].row = -1;
+  }
+}
+
+// Drops the tiles that overlap page rows [top, bottom), keeping the rest
+// valid for an updated display list.
+void invalidate_tile_rows(int top, int bottom) {
+  for (int i = 0; i < tile_count; i++) {
+    if (tiles[i].row >= 0 && tiles[i].row * TILE_SIZE < bottom &&
+        (tiles[i].row + 1) * TILE_SIZE > top) {
+      tiles[i].column = -1;
+      tiles[i].row = -1;
+    }
+  }
+}
+
+void free_tiles() {
+  for (int i = 0; i < tile_count; i++) {
+    SDL_DestroyTexture(tiles[i].texture);
+  }
+  texture_cache.bytes -= tile_count * TILE_BYTES;
+  free(tiles);
+  tiles = NULL;
+  tile_count = 0;
+}
+
+Tile *find_tile(int column, int row) {
+  for (int i = 0; i < tile_count; i++) {
+    if (tiles[i].column == column && tiles[i].row == row) {
+      return &tiles[i];
+    }
+  }
+  return NULL;
+}
+
+// Destroys the texture of `tile`, returns its bytes to the texture budget
+// and removes it by moving the last tile into its place.
+void discard_tile(Tile *tile) {
+  SDL_DestroyTexture(tile->texture);
+  texture_cache.bytes -= TILE_BYTES;
+  *tile = tiles[--tile_count];
+}
+
+// Returns a tile for (column, row) whose contents still have to be painted.
+// Empty tiles are reused first. Otherwise tiles not shown in this frame are
+// evicted, least recently shown first, while the textures are over budget.
+Tile *new_tile(int column, int row) {
+  Tile *tile = find_tile(-1, -1);
+  if (tile == NULL) {
+    while (texture_cache.bytes + TILE_BYTES > texture_cache.budget) {
+      Tile *oldest = NULL;
+      for (int i = 0; i < tile_count; i++) {
+        if (tiles[i].last_used != render_frame &&
+            (oldest == NULL || tiles[i].last_used < oldest->last_used)) {
+          oldest = &tiles[i];
+        }
+      }
+      if (oldest == NULL) {
+        break;
+      }
+      discard_tile(oldest);
+    }
+    reserve_texture_bytes(TILE_BYTES);
+    SDL_Texture *texture =
+        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                          SDL_TEXTUREACCESS_TARGET, TILE_SIZE, TILE_SIZE);
+    if (texture == NULL) {
+      return NULL;
+    }
+    tiles = realloc(tiles, (tile_count + 1) * sizeof(Tile));
+    if (tiles == NULL) {
+      error("メモリを確保できません\n");
+    }
+    tile = &tiles[tile_count++];
+    tile->texture = texture;
+    texture_cache.bytes += TILE_BYTES;
+  }
+  tile->column = column;
+  tile->row = row;
+  tile->last_used = render_frame;
+  tile->prefetched = false;
+  return tile;
+}
+
+void render_tile(DisplayList *list, Tile *tile) {
+  SDL_SetRenderTarget(renderer, tile->texture);
+  SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+  SDL_RenderClear(renderer);
+  SDL_Rect area = {tile->column * TILE_SIZE, tile->row * TILE_SIZE, TILE_SIZE,
+                   TILE_SIZE};
+  paint_area(list, &area);
+  SDL_SetRenderTarget(renderer, NULL);
+}
+
+// Makes sure every tile under the viewport is painted. Returns false when a
+// tile texture cannot be created.
+bool prepare_tiles(DisplayList *list, int first_column, int last_column,
+                   int first_row, int last_row) {
+  for (int row = first_row; row <= last_row; row++) {
+    for (int column = first_column; column <= last_column; column++) {
+      Tile *tile = find_tile(column, row);
+      if (tile == NULL) {
+        tile = new_tile(column, row);
+        if (tile == NULL) {
+          return false;
+        }
+        render_tile(list, tile);
+      }
+      tile->last_used = render_frame;
+      tile->prefetched = false;
+    }
+  }
+  return true;
+}
+
+int sign(int value) { return (value > 0) - (value < 0); }
+
+// Records a scroll step. The prefetch distance follows the scroll speed.
+// When the direction turns, tiles prefetched for the old direction are
+// freed so that their textures no longer count against the budget.
+void track_scroll(int delta_x, int delta_y) {
+  int direction_x = sign(delta_x);
+  int direction_y = sign(delta_y);
+  if ((direction_x && direction_x == -prefetch_direction_x) ||
+      (direction_y && direction_y == -prefetch_direction_y)) {
+    // 後ろから詰めるので、移ってきたタイルも見落とさない
+    for (int i = tile_count - 1; i >= 0; i--) {
+      if (tiles[i].prefetched) {
+        discard_tile(&tiles[i]);
+      }
+    }
+  }
+  prefetch_direction_x = direction_x;
+  prefetch_direction_y = direction_y;
+  int speed = abs(delta_x) > abs(delta_y) ? abs(delta_x) : abs(delta_y);
+  prefetch_distance = speed * PREFETCH_FRAMES;
+  if (prefetch_distance < TILE_SIZE) {
+    prefetch_distance = TILE_SIZE;
+  } else if (prefetch_distance > MAX_PREFETCH_DISTANCE) {
+    prefetch_distance = MAX_PREFETCH_DISTANCE;
+  }
+}
+
+// Paints one missing tile within the prefetch distance ahead of the window,
+// nearest first. Meant for idle time between frames; returns false when
+// there is nothing left to prefetch.
+bool prefetch_tile(DisplayList *list) {
+  if (list->generation != tile_generation ||
+      !SDL_RenderTargetSupported(renderer) ||
+      (prefetch_direction_x == 0 && prefetch_direction_y == 0)) {
+    return false;
+  }
+  int left = scroll_offset_x;
+  int right = scroll_offset_x + window_width;
+  int top = scroll_offset_y;
+  int bottom = scroll_offset_y + window_height;
+  if (prefetch_direction_x > 0) {
+    right += prefetch_distance;
+  } else if (prefetch_direction_x < 0) {
+    left -= prefetch_distance;
+  }
+  if (prefetch_direction_y > 0) {
+    bottom += prefetch_distance;
+  } else if (prefetch_direction_y < 0) {
+    top -= prefetch_distance;
+  }
+  // ページの外は先読みしない
+  left = left < 0 ? 0 : left;
+  top = top < 0 ? 0 : top;
+  right = right > list->width ? list->width : right;
+  bottom = bottom > list->height ? list->height : bottom;
+  if (left >= right || top >= bottom) {
+    return false;
+  }
+
+  int first_column = left / TILE_SIZE;
+  int last_column = (right - 1) / TILE_SIZE;
+  int first_row = top / TILE_SIZE;
+  int last_row = (bottom - 1) / TILE_SIZE;
+  int rows = last_row - first_row + 1;
+  int columns = last_column - first_column + 1;
+  for (int r = 0; r < rows; r++) {
+    int row = prefetch_direction_y < 0 ? last_row - r : first_row + r;
+    for (int c = 0; c < columns; c++) {
+      int column =
+          prefetch_direction_x < 0 ? last_column - c : first_column + c;
+      if (find_tile(column, row) != NULL) {
+        continue;
+      }
+      Tile *tile = new_tile(column, row);
+      if (tile == NULL) {
+        return false;
+      }
+      render_tile(list, tile);
+      tile->prefetched = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Shows the page at the current scroll offset. The page is painted once
+// into TILE_SIZE render-target tiles, and scrolling only composites the
+// tiles that overlap the window. Tiles are painted again after a relayout.
+// Without render-target support, the visible area is painted directly.
+void draw_window(DisplayList *list) {
+  trim_glyph_atlases();
+  tick_font_cache(&main_fonts);
+  render_frame++;
+  if (list->generation != tile_generation) {
+    invalidate_tiles();
+    tile_generation = list->generation;
+  }
+
+  int first_column = scroll_offset_x / TILE_SIZE;
+  int last_column = (scroll_offset_x + window_width - 1) / TILE_SIZE;
+  int first_row = scroll_offset_y / TILE_SIZE;
+  int last_row = (scroll_offset_y + window_height - 1) / TILE_SIZE;
+  bool tiled = SDL_RenderTargetSupported(renderer) &&
+               prepare_tiles(list, first_column, last_column, first_row,
+                             last_row);
+
+  SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+  SDL_RenderClear(renderer);
+  if (tiled) {
+    for (int row = first_row; row <= last_row; row++) {
+      for (int column = first_column; column <= last_column; column++) {
+        Tile *tile = find_tile(column, row);
+        SDL_Rect dstrect = {column * TILE_SIZE - scroll_offset_x,
+                            row * TILE_SIZE - scroll_offset_y, TILE_SIZE,
+                            TILE_SIZE};
+        SDL_RenderCopy(renderer, tile->texture, NULL, &dstrect);
+      }
+    }
+  } else {
+    SDL_Rect view = {scroll_offset_x, scroll_offset_y, window_width,
+                     window_height};
+    paint_area(list, &view);
+  }
+
+  SDL_RenderPresent(renderer);
+}
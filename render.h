@@ -0,0 +1,52 @@
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "layout.h"
+#include "parser.h"
+
+#ifndef BROWSER_RENDER_H
+#define BROWSER_RENDER_H
+
+#define TILE_SIZE 512
+#define TILE_BYTES ((size_t)TILE_SIZE * TILE_SIZE * 4)
+#define PREFETCH_FRAMES 8
+#define MAX_PREFETCH_DISTANCE (2 * TILE_SIZE)
+
+// A TILE_SIZE square of the page, painted once into a render target.
+// Empty tiles have a column and row of -1 and keep their texture for reuse.
+// `prefetched` is set until a tile painted ahead of the scroll is shown.
+typedef struct {
+  int column;
+  int row;
+  unsigned last_used;
+  bool prefetched;
+  SDL_Texture *texture;
+} Tile;
+
+extern SDL_Window *window;
+extern SDL_Renderer *renderer;
+
+extern int window_height;
+extern int window_width;
+
+extern int scroll_width;
+extern int scroll_height;
+
+extern int scroll_offset_x;
+extern int scroll_offset_y;
+
+void invalidate_tiles();
+
+void invalidate_tile_rows(int top, int bottom);
+
+void free_tiles();
+
+void track_scroll(int delta_x, int delta_y);
+
+bool prefetch_tile(DisplayList *list);
+
+void draw_window(DisplayList *list);
+
+#endif
@@ -0,0 +1,145 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef BROWSER_SCAN_H
+#define BROWSER_SCAN_H
+
+// Byte scanning kernels used by the tokenizer. Each function looks at 32
+// (AVX2) or 16 (SSE2) bytes per step and finishes the tail one byte at a
+// time. Without SIMD support only the scalar loop is compiled.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) ||                                 \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCAN_SSE2
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+static inline int scan_ctz(uint32_t mask) {
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (int)index;
+}
+#else
+static inline int scan_ctz(uint32_t mask) { return __builtin_ctz(mask); }
+#endif
+
+// HTML whitespace as accepted by isspace() in the "C" locale.
+static inline bool scan_is_space(unsigned char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Returns the first `c` in [p, end), or `end`.
+static inline char *scan_byte(char *p, char *end, char c) {
+#if defined(SCAN_AVX2)
+  __m256i needle = _mm256_set1_epi8(c);
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+    if (mask) {
+      return p + scan_ctz(mask);
+    }
+  }
+#elif defined(SCAN_SSE2)
+  __m128i needle = _mm_set1_epi8(c);
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+    if (mask) {
+      return p + scan_ctz(mask);
+    }
+  }
+#endif
+  while (p < end && *p != c) {
+    p++;
+  }
+  return p;
+}
+
+// Returns the first whitespace byte in [p, end), or `end`.
+static inline char *scan_space(char *p, char *end) {
+#if defined(SCAN_AVX2)
+  __m256i space = _mm256_set1_epi8(' ');
+  __m256i tab = _mm256_set1_epi8('\t');
+  __m256i four = _mm256_set1_epi8(4);
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    // '\t'..'\r' は (c - '\t') が符号なしで 4 以下になる
+    __m256i control = _mm256_sub_epi8(v, tab);
+    control = _mm256_cmpeq_epi8(_mm256_min_epu8(control, four), control);
+    uint32_t mask = _mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, space), control));
+    if (mask) {
+      return p + scan_ctz(mask);
+    }
+  }
+#elif defined(SCAN_SSE2)
+  __m128i space = _mm_set1_epi8(' ');
+  __m128i tab = _mm_set1_epi8('\t');
+  __m128i four = _mm_set1_epi8(4);
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    // '\t'..'\r' は (c - '\t') が符号なしで 4 以下になる
+    __m128i control = _mm_sub_epi8(v, tab);
+    control = _mm_cmpeq_epi8(_mm_min_epu8(control, four), control);
+    uint32_t mask =
+        _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, space), control));
+    if (mask) {
+      return p + scan_ctz(mask);
+    }
+  }
+#endif
+  while (p < end && !scan_is_space(*p)) {
+    p++;
+  }
+  return p;
+}
+
+// Returns the first byte of a multibyte UTF-8 sequence in [p, end), or
+// `end`.
+static inline char *scan_non_ascii(char *p, char *end) {
+#if defined(SCAN_AVX2)
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    uint32_t mask = _mm256_movemask_epi8(v);
+    if (mask) {
+      return p + scan_ctz(mask);
+    }
+  }
+#elif defined(SCAN_SSE2)
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    uint32_t mask = _mm_movemask_epi8(v);
+    if (mask) {
+      return p + scan_ctz(mask);
+    }
+  }
+#endif
+  while (p < end && (unsigned char)*p < 0x80) {
+    p++;
+  }
+  return p;
+}
+
+// Returns the first occurrence of `needle` in [p, end), or `end`.
+static inline char *scan_string(char *p, char *end, char *needle,
+                                size_t length) {
+  while (p < end) {
+    p = scan_byte(p, end, needle[0]);
+    if ((size_t)(end - p) < length) {
+      return end;
+    }
+    if (memcmp(p, needle, length) == 0) {
+      return p;
+    }
+    p++;
+  }
+  return end;
+}
+
+#endif
@@ -0,0 +1,185 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "fonts.h"
+#include "parser.h"
+#include "render.h"
+#include "texture_cache.h"
+
+TextureCache texture_cache = {.budget = TEXTURE_BUDGET};
+
+uint32_t hash_text_key(int size, int style, SDL_Color color, char *text,
+                       size_t length) {
+  uint32_t hash = 2166136261u;
+  hash = hash_bytes(hash, &size, sizeof(size));
+  hash = hash_bytes(hash, &style, sizeof(style));
+  hash = hash_bytes(hash, &color, sizeof(color));
+  return hash_bytes(hash, text, length);
+}
+
+void unlink_texture(CachedTexture *entry) {
+  if (entry->newer) {
+    entry->newer->older = entry->older;
+  } else {
+    texture_cache.newest = entry->older;
+  }
+  if (entry->older) {
+    entry->older->newer = entry->newer;
+  } else {
+    texture_cache.oldest = entry->newer;
+  }
+  entry->newer = NULL;
+  entry->older = NULL;
+}
+
+void link_newest(CachedTexture *entry) {
+  entry->older = texture_cache.newest;
+  if (texture_cache.newest) {
+    texture_cache.newest->newer = entry;
+  } else {
+    texture_cache.oldest = entry;
+  }
+  texture_cache.newest = entry;
+}
+
+void evict_texture(CachedTexture *entry) {
+  CachedTexture **slot =
+      &texture_cache.buckets[entry->hash & (texture_cache.bucket_count - 1)];
+  while (*slot != entry) {
+    slot = &(*slot)->chain;
+  }
+  *slot = entry->chain;
+  unlink_texture(entry);
+  SDL_DestroyTexture(entry->texture);
+  texture_cache.bytes -= entry->bytes;
+  texture_cache.count--;
+  free(entry->text);
+  free(entry);
+}
+
+// Evicts the least recently used text textures until `bytes` more fit in
+// the budget or there is nothing left to evict.
+void reserve_texture_bytes(size_t bytes) {
+  while (texture_cache.oldest &&
+         texture_cache.bytes + bytes > texture_cache.budget) {
+    evict_texture(texture_cache.oldest);
+  }
+}
+
+void grow_buckets() {
+  int old_count = texture_cache.bucket_count;
+  CachedTexture **old_buckets = texture_cache.buckets;
+  texture_cache.bucket_count = old_count ? old_count * 2 : 256;
+  texture_cache.buckets =
+      calloc(texture_cache.bucket_count, sizeof(CachedTexture *));
+  if (texture_cache.buckets == NULL) {
+    error("メモリを確保できません\n");
+  }
+  uint32_t mask = texture_cache.bucket_count - 1;
+  for (int i = 0; i < old_count; i++) {
+    CachedTexture *entry = old_buckets[i];
+    while (entry) {
+      CachedTexture *next = entry->chain;
+      CachedTexture **slot = &texture_cache.buckets[entry->hash & mask];
+      entry->chain = *slot;
+      *slot = entry;
+      entry = next;
+    }
+  }
+  free(old_buckets);
+}
+
+// Returns the texture of the `length` bytes of `text` rasterized at `size`
+// pixels with the given style and color, rasterizing it on a miss. The
+// texture stays owned by the cache.
+SDL_Texture *find_text_texture(int size, int style, SDL_Color color,
+                               char *text, int length, int *width,
+                               int *height) {
+  uint32_t hash = hash_text_key(size, style, color, text, length);
+  if (texture_cache.bucket_count) {
+    CachedTexture *entry =
+        texture_cache.buckets[hash & (texture_cache.bucket_count - 1)];
+    for (; entry; entry = entry->chain) {
+      if (entry->hash == hash && entry->size == size &&
+          entry->style == style && entry->color.r == color.r &&
+          entry->color.g == color.g && entry->color.b == color.b &&
+          entry->color.a == color.a && entry->length == length &&
+          memcmp(entry->text, text, length) == 0) {
+        unlink_texture(entry);
+        link_newest(entry);
+        *width = entry->width;
+        *height = entry->height;
+        return entry->texture;
+      }
+    }
+  }
+
+  // SDL_ttf は終端された文字列しか受け取らないので、キーの複製から描く
+  char *copy = malloc(length + 1);
+  if (copy == NULL) {
+    return NULL;
+  }
+  memcpy(copy, text, length);
+  copy[length] = '\0';
+  SDL_Surface *surface =
+      TTF_RenderUTF8_Blended(get_font(size, style), copy, color);
+  if (surface == NULL) {
+    free(copy);
+    return NULL;
+  }
+  size_t bytes = (size_t)surface->w * surface->h * 4;
+  reserve_texture_bytes(bytes);
+  SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
+  CachedTexture *entry = calloc(1, sizeof(CachedTexture));
+  if (texture == NULL || entry == NULL) {
+    SDL_FreeSurface(surface);
+    if (texture) {
+      SDL_DestroyTexture(texture);
+    }
+    free(entry);
+    free(copy);
+    return NULL;
+  }
+  entry->text = copy;
+  entry->length = length;
+  entry->size = size;
+  entry->style = style;
+  entry->color = color;
+  entry->hash = hash;
+  entry->texture = texture;
+  entry->width = surface->w;
+  entry->height = surface->h;
+  entry->bytes = bytes;
+  SDL_FreeSurface(surface);
+
+  if (texture_cache.count * 4 >= texture_cache.bucket_count * 3) {
+    grow_buckets();
+  }
+  CachedTexture **slot =
+      &texture_cache.buckets[hash & (texture_cache.bucket_count - 1)];
+  entry->chain = *slot;
+  *slot = entry;
+  link_newest(entry);
+  texture_cache.count++;
+  texture_cache.bytes += bytes;
+
+  *width = entry->width;
+  *height = entry->height;
+  return texture;
+}
+
+void free_texture_cache() {
+  while (texture_cache.oldest) {
+    evict_texture(texture_cache.oldest);
+  }
+  free(texture_cache.buckets);
+  texture_cache.buckets = NULL;
+  texture_cache.bucket_count = 0;
+}
@@ -0,0 +1,54 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#ifndef BROWSER_TEXTURE_CACHE_H
+#define BROWSER_TEXTURE_CACHE_H
+
+// 既定のテクスチャ予算。LSB_TEXTURE_BUDGET_MB で変更できる
+#define TEXTURE_BUDGET (64 * 1024 * 1024)
+
+// A rasterized text run. Entries are keyed by their content, not by where
+// they appear, so relayouts and repeated words share one texture.
+typedef struct CachedTexture {
+  char *text;
+  int length;
+  int size;
+  int style;
+  SDL_Color color;
+  uint32_t hash;
+  SDL_Texture *texture;
+  int width;
+  int height;
+  size_t bytes;
+  struct CachedTexture *chain;
+  struct CachedTexture *newer;
+  struct CachedTexture *older;
+} CachedTexture;
+
+// Text textures in least-recently-used order, plus the byte count of every
+// texture charged against the budget (glyph atlas pages included).
+typedef struct {
+  CachedTexture **buckets;
+  int bucket_count;
+  int count;
+  CachedTexture *newest;
+  CachedTexture *oldest;
+  size_t budget;
+  size_t bytes;
+} TextureCache;
+
+extern TextureCache texture_cache;
+
+SDL_Texture *find_text_texture(int size, int style, SDL_Color color,
+                               char *text, int length, int *width,
+                               int *height);
+
+void reserve_texture_bytes(size_t bytes);
+
+void free_texture_cache();
+
+#endif
@@ -0,0 +1,108 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "parser.h"
+#include "watch.h"
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define WATCH_POLL_MS 200
+
+SDL_Thread *watch_thread;
+SDL_atomic_t watch_quit;
+int watch_fd = -1;
+char *watch_name;
+Uint32 watch_event;
+
+// エディタは上書きか別名からの置き換えで保存するので、ディレクトリごと監視する
+int watch_main(void *data) {
+  (void)data;
+  char buffer[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct pollfd pfd = {watch_fd, POLLIN, 0};
+  while (!SDL_AtomicGet(&watch_quit)) {
+    if (poll(&pfd, 1, WATCH_POLL_MS) <= 0) {
+      continue;
+    }
+    ssize_t length = read(watch_fd, buffer, sizeof(buffer));
+    bool matched = false;
+    for (char *p = buffer; p < buffer + length;) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      if (event->len > 0 && strcmp(event->name, watch_name) == 0) {
+        matched = true;
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+    if (matched) {
+      SDL_Event event = {0};
+      event.type = watch_event;
+      SDL_PushEvent(&event);
+    }
+  }
+  return 0;
+}
+
+// Pushes an `event_type` event whenever `file_name` is saved. Returns false
+// when the file cannot be watched.
+bool start_file_watch(char *file_name, Uint32 event_type) {
+  char *directory = strdup(file_name);
+  char *slash = strrchr(directory, '/');
+  if (slash == NULL) {
+    strcpy(directory, ".");
+    watch_name = file_name;
+  } else {
+    slash[1] = '\0';
+    watch_name = file_name + (slash - directory) + 1;
+  }
+  watch_event = event_type;
+  watch_fd = inotify_init1(IN_CLOEXEC);
+  if (watch_fd < 0 || inotify_add_watch(watch_fd, directory,
+                                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    warning("%s を監視できません\n", file_name);
+    free(directory);
+    stop_file_watch();
+    return false;
+  }
+  free(directory);
+  watch_thread = SDL_CreateThread(watch_main, "watch", NULL);
+  if (watch_thread == NULL) {
+    warning("SDL_CreateThread Error: %s\n", SDL_GetError());
+    stop_file_watch();
+    return false;
+  }
+  return true;
+}
+
+void stop_file_watch() {
+  if (watch_thread != NULL) {
+    SDL_AtomicSet(&watch_quit, 1);
+    SDL_WaitThread(watch_thread, NULL);
+    watch_thread = NULL;
+  }
+  if (watch_fd >= 0) {
+    close(watch_fd);
+    watch_fd = -1;
+  }
+}
+
+#else
+
+bool start_file_watch(char *file_name, Uint32 event_type) {
+  (void)event_type;
+  warning("この環境では %s を監視できません\n", file_name);
+  return false;
+}
+
+void stop_file_watch() {}
+
+#endif
@@ -0,0 +1,12 @@
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+
+#ifndef BROWSER_WATCH_H
+#define BROWSER_WATCH_H
+
+bool start_file_watch(char *file_name, Uint32 event_type);
+
+void stop_file_watch();
+
+#endif
@@ -0,0 +1,92 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "fonts.h"
+#include "parser.h"
+#include "word_cache.h"
+
+WordCache word_cache;
+
+uint32_t hash_word_key(int size, int style, char *text, int length) {
+  uint32_t hash = 2166136261u;
+  hash = hash_bytes(hash, &size, sizeof(size));
+  hash = hash_bytes(hash, &style, sizeof(style));
+  return hash_bytes(hash, text, length);
+}
+
+void grow_word_buckets() {
+  int old_count = word_cache.bucket_count;
+  CachedWord **old_buckets = word_cache.buckets;
+  word_cache.bucket_count = old_count ? old_count * 2 : 1024;
+  word_cache.buckets = calloc(word_cache.bucket_count, sizeof(CachedWord *));
+  if (word_cache.buckets == NULL) {
+    error("メモリを確保できません\n");
+  }
+  uint32_t mask = word_cache.bucket_count - 1;
+  for (int i = 0; i < old_count; i++) {
+    CachedWord *entry = old_buckets[i];
+    while (entry) {
+      CachedWord *next = entry->chain;
+      CachedWord **slot = &word_cache.buckets[entry->hash & mask];
+      entry->chain = *slot;
+      *slot = entry;
+      entry = next;
+    }
+  }
+  free(old_buckets);
+}
+
+// Returns the width of `length` bytes of `text` at `size` pixels in
+// `style`. Only the first use of a word reaches FreeType.
+int measure_word(int size, int style, char *text, int length) {
+  uint32_t hash = hash_word_key(size, style, text, length);
+  if (word_cache.bucket_count) {
+    CachedWord *entry =
+        word_cache.buckets[hash & (word_cache.bucket_count - 1)];
+    for (; entry; entry = entry->chain) {
+      if (entry->hash == hash && entry->size == size &&
+          entry->style == style && entry->length == length &&
+          memcmp(entry->text, text, length) == 0) {
+        return entry->width;
+      }
+    }
+  }
+
+  if (word_cache.count >= WORD_CACHE_LIMIT) {
+    free_word_cache();
+  }
+  if (word_cache.count * 4 >= word_cache.bucket_count * 3) {
+    grow_word_buckets();
+  }
+  CachedWord *entry =
+      arena_alloc(&word_cache.arena, sizeof(CachedWord) + length + 1);
+  memcpy(entry->text, text, length);
+  entry->text[length] = '\0';
+  entry->size = size;
+  entry->style = style;
+  entry->hash = hash;
+  entry->length = length;
+  if (TTF_SizeUTF8(get_font(size, style), entry->text, &entry->width,
+                   NULL) != 0) {
+    entry->width = 0;
+  }
+  CachedWord **slot =
+      &word_cache.buckets[hash & (word_cache.bucket_count - 1)];
+  entry->chain = *slot;
+  *slot = entry;
+  word_cache.count++;
+  return entry->width;
+}
+
+void free_word_cache() {
+  free(word_cache.buckets);
+  arena_free(&word_cache.arena);
+  word_cache = (WordCache){0};
+}
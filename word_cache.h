@@ -0,0 +1,39 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser.h"
+
+#ifndef BROWSER_WORD_CACHE_H
+#define BROWSER_WORD_CACHE_H
+
+// これを超えたら作り直す。単語の種類はページが変わらない限りほぼ増えない
+#define WORD_CACHE_LIMIT (64 * 1024)
+
+// The measured width of one word of the page font at one size and style.
+typedef struct CachedWord {
+  int size;
+  int style;
+  uint32_t hash;
+  int length;
+  int width;
+  struct CachedWord *chain;
+  char text[];
+} CachedWord;
+
+// Word widths keyed by their content, so a relayout at another width only
+// adds up widths measured before.
+typedef struct {
+  CachedWord **buckets;
+  int bucket_count;
+  int count;
+  Arena arena;
+} WordCache;
+
+extern WordCache word_cache;
+
+int measure_word(int size, int style, char *text, int length);
+
+void free_word_cache();
+
+#endif